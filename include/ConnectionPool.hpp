@@ -0,0 +1,262 @@
+//
+//  cppsocket
+//
+
+#ifndef CPPSOCKET_CONNECTIONPOOL_HPP
+#define CPPSOCKET_CONNECTIONPOOL_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "Socket.hpp"
+
+namespace cppsocket
+{
+    // keeps idle connected sockets per remote endpoint, so that acquiring one does not need a DNS lookup or a handshake,
+    // the resolved addresses are cached for the resolve TTL and prewarm always resolves again
+    class ConnectionPool final
+    {
+    public:
+        explicit ConnectionPool(Network& aNetwork, size_t aIdleCount = 4):
+            network(aNetwork), idleCount(aIdleCount)
+        {
+        }
+
+        // the pooled sockets refer to this object in their callbacks
+        ConnectionPool(const ConnectionPool&) = delete;
+        ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+        size_t getIdleCount() const { return idleCount; }
+        void setIdleCount(size_t newIdleCount) { idleCount = newIdleCount; }
+
+        float getConnectTimeout() const { return connectTimeout; }
+        void setConnectTimeout(float timeout) { connectTimeout = timeout; }
+
+        float getResolveTtl() const { return resolveTtl; }
+        // number of seconds a resolved address is used before it is looked up again, 0 resolves on every call
+        void setResolveTtl(float newResolveTtl) { resolveTtl = newResolveTtl; }
+
+        // resolves the address again and opens connections to it until it has idleCount idle or connecting sockets
+        void prewarm(const std::string& address)
+        {
+            refill(resolve(address, true));
+        }
+
+        // returns an idle connected socket with no callbacks set or nullptr if none is available,
+        // the pool starts connecting a replacement in both cases
+        std::unique_ptr<Socket> acquire(const std::string& address)
+        {
+            const Key key = resolve(address);
+            Endpoint& endpoint = endpoints[key];
+            std::unique_ptr<Socket> result;
+
+            while (!endpoint.idle.empty() && !result)
+            {
+                std::unique_ptr<Socket> socket = std::move(endpoint.idle.back());
+                endpoint.idle.pop_back();
+
+                if (socket->isReady())
+                    result = std::move(socket);
+            }
+
+            if (result)
+                resetCallbacks(*result);
+
+            refill(key);
+
+            return result;
+        }
+
+        // returns a socket acquired from the pool, closed sockets and sockets over the idle count are dropped
+        void release(std::unique_ptr<Socket> socket)
+        {
+            if (!socket || !socket->isReady() || socket->hasOutData())
+                return;
+
+            const Key key(socket->getRemoteAddress(), socket->getRemotePort());
+            Endpoint& endpoint = endpoints[key];
+
+            if (endpoint.idle.size() >= idleCount)
+                return;
+
+            watchIdle(key, *socket);
+            endpoint.idle.push_back(std::move(socket));
+        }
+
+        size_t getIdleSocketCount(const std::string& address)
+        {
+            auto i = endpoints.find(resolve(address));
+            return (i == endpoints.end()) ? 0 : i->second.idle.size();
+        }
+
+    private:
+        using Key = std::pair<uint32_t, uint16_t>;
+
+        struct Endpoint
+        {
+            std::vector<std::unique_ptr<Socket>> idle;
+            std::vector<std::unique_ptr<Socket>> connecting;
+        };
+
+        struct ResolvedAddress
+        {
+            Key key;
+            std::chrono::steady_clock::time_point expiration;
+        };
+
+        Key resolve(const std::string& address, bool refresh = false)
+        {
+            const auto currentTime = std::chrono::steady_clock::now();
+            auto i = addresses.find(address);
+
+            if (i != addresses.end() && !refresh && currentTime < i->second.expiration)
+                return i->second.key;
+
+            const Key key = getAddress(address);
+            const auto expiration = currentTime +
+                std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float>(resolveTtl));
+
+            if (i == addresses.end())
+            {
+                ResolvedAddress& resolved = addresses[address];
+                resolved.key = key;
+                resolved.expiration = expiration;
+            }
+            else
+            {
+                const Key previousKey = i->second.key;
+                i->second.key = key;
+                i->second.expiration = expiration;
+
+                // the sockets of an endpoint that no address resolves to any more are closed
+                if (previousKey != key && !isResolved(previousKey))
+                    endpoints.erase(previousKey);
+            }
+
+            return key;
+        }
+
+        bool isResolved(const Key& key) const
+        {
+            for (const auto& address : addresses)
+                if (address.second.key == key)
+                    return true;
+
+            return false;
+        }
+
+        void refill(const Key& key)
+        {
+            Endpoint& endpoint = endpoints[key];
+
+            while (endpoint.idle.size() + endpoint.connecting.size() < idleCount)
+            {
+                std::unique_ptr<Socket> socket(new Socket(network));
+                socket->setBlocking(false);
+                socket->setConnectTimeout(connectTimeout);
+
+                Socket* socketPtr = socket.get();
+                endpoint.connecting.push_back(std::move(socket));
+
+                socketPtr->setConnectCallback([this, key](Socket& connected) {
+                    Endpoint& connectedEndpoint = endpoints[key];
+                    std::unique_ptr<Socket> connectedSocket = take(connectedEndpoint.connecting, connected);
+
+                    if (connectedSocket)
+                    {
+                        watchIdle(key, connected);
+                        connectedEndpoint.idle.push_back(std::move(connectedSocket));
+                    }
+                });
+
+                // failures are handled by the close and connect error callbacks
+                socketPtr->setErrorCallback([](Socket&, const std::error_code&) {});
+
+                socketPtr->setConnectErrorCallback([this, key](Socket& failed) {
+                    // a failed endpoint is not reconnected until the next prewarm or acquire
+                    if (!starting)
+                        take(endpoints[key].connecting, failed);
+                });
+
+                starting = true;
+
+                try
+                {
+                    socketPtr->connect(key.first, key.second);
+                }
+                catch (...)
+                {
+                    starting = false;
+                    take(endpoint.connecting, *socketPtr);
+                    throw;
+                }
+
+                starting = false;
+            }
+        }
+
+        void watchIdle(const Key& key, Socket& socket)
+        {
+            socket.setErrorCallback([](Socket&, const std::error_code&) {});
+
+            // an idle socket is dropped and replaced when it closes or when the peer sends unsolicited data
+            // the dropped socket owns the callback, so it is destroyed when the callback returns
+            socket.setCloseCallback([this, key](Socket& closed) {
+                std::unique_ptr<Socket> dropped = take(endpoints[key].idle, closed);
+                refill(key);
+            });
+
+            socket.setReadCallback([this, key](Socket& unsolicited, const std::vector<uint8_t>&) {
+                std::unique_ptr<Socket> dropped = take(endpoints[key].idle, unsolicited);
+                if (dropped)
+                {
+                    dropped->setCloseCallback(nullptr);
+                    dropped->close();
+                }
+                refill(key);
+            });
+        }
+
+        static void resetCallbacks(Socket& socket)
+        {
+            socket.setReadCallback(nullptr);
+            socket.setCloseCallback(nullptr);
+            socket.setAcceptCallback(nullptr);
+            socket.setConnectCallback(nullptr);
+            socket.setConnectErrorCallback(nullptr);
+            socket.setDrainCallback(nullptr);
+            socket.setErrorCallback(nullptr);
+            socket.setSendTimestampCallback(nullptr);
+            socket.setTcpInfoSampler(0.0f, nullptr);
+        }
+
+        static std::unique_ptr<Socket> take(std::vector<std::unique_ptr<Socket>>& sockets, Socket& socket)
+        {
+            auto i = std::find_if(sockets.begin(), sockets.end(), [&socket](const std::unique_ptr<Socket>& s) {
+                return s.get() == &socket;
+            });
+
+            if (i == sockets.end())
+                return nullptr;
+
+            std::unique_ptr<Socket> result = std::move(*i);
+            sockets.erase(i);
+            return result;
+        }
+
+        Network& network;
+        size_t idleCount;
+        float connectTimeout = 10.0f;
+        float resolveTtl = 60.0f;
+        bool starting = false;
+
+        std::map<std::string, ResolvedAddress> addresses;
+        std::map<Key, Endpoint> endpoints;
+    };
+}
+
+#endif // CPPSOCKET_CONNECTIONPOOL_HPP
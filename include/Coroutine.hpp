@@ -0,0 +1,512 @@
+//
+//  cppsocket
+//
+
+#ifndef CPPSOCKET_COROUTINE_HPP
+#define CPPSOCKET_COROUTINE_HPP
+
+#if !defined(__cpp_impl_coroutine) && !(defined(_MSVC_LANG) && _MSVC_LANG >= 202002L)
+#  error "Coroutine.hpp requires C++20 coroutine support"
+#endif
+
+#include <coroutine>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <new>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+#include "Socket.hpp"
+
+namespace cppsocket
+{
+    // per-thread free lists of coroutine frames, so that starting a task does not hit the allocator
+    class FramePool final
+    {
+    public:
+        static void* allocate(size_t size)
+        {
+            const size_t index = getIndex(size);
+
+            if (index >= BUCKET_COUNT)
+                return ::operator new(size);
+
+            Block*& head = getBuckets()[index];
+
+            if (head)
+            {
+                Block* block = head;
+                head = block->next;
+                return block;
+            }
+
+            return ::operator new((index + 1) * GRANULARITY);
+        }
+
+        static void deallocate(void* pointer, size_t size) noexcept
+        {
+            const size_t index = getIndex(size);
+
+            if (index >= BUCKET_COUNT)
+            {
+                ::operator delete(pointer);
+                return;
+            }
+
+            Block*& head = getBuckets()[index];
+            Block* block = static_cast<Block*>(pointer);
+            block->next = head;
+            head = block;
+        }
+
+    private:
+        static constexpr size_t GRANULARITY = 64;
+        static constexpr size_t BUCKET_COUNT = 32;
+
+        struct Block
+        {
+            Block* next;
+        };
+
+        class Buckets final
+        {
+        public:
+            Buckets() = default;
+            Buckets(const Buckets&) = delete;
+            Buckets& operator=(const Buckets&) = delete;
+
+            ~Buckets()
+            {
+                for (Block*& head : heads)
+                {
+                    while (head)
+                    {
+                        Block* block = head;
+                        head = block->next;
+                        ::operator delete(block);
+                    }
+                }
+            }
+
+            Block*& operator[](size_t index) { return heads[index]; }
+
+        private:
+            Block* heads[BUCKET_COUNT] = {};
+        };
+
+        static size_t getIndex(size_t size) noexcept
+        {
+            return (size + GRANULARITY - 1) / GRANULARITY - 1;
+        }
+
+        static Buckets& getBuckets()
+        {
+            static thread_local Buckets buckets;
+            return buckets;
+        }
+    };
+
+    // lazily started coroutine, either awaited by another task or started detached with start()
+    class Task final
+    {
+    public:
+        class promise_type final
+        {
+            friend Task;
+        public:
+            Task get_return_object()
+            {
+                return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+            }
+
+            std::suspend_always initial_suspend() noexcept { return {}; }
+
+            auto final_suspend() noexcept
+            {
+                struct FinalAwaiter final
+                {
+                    bool await_ready() noexcept { return false; }
+
+                    std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+                    {
+                        promise_type& promise = handle.promise();
+
+                        if (promise.continuation)
+                            return promise.continuation;
+
+                        if (promise.detached)
+                            handle.destroy();
+
+                        return std::noop_coroutine();
+                    }
+
+                    void await_resume() noexcept {}
+                };
+
+                return FinalAwaiter();
+            }
+
+            void return_void() {}
+
+            void unhandled_exception()
+            {
+                // nobody can observe the exception of a detached task
+                if (detached)
+                    std::terminate();
+
+                exception = std::current_exception();
+            }
+
+            static void* operator new(size_t size)
+            {
+                return FramePool::allocate(size);
+            }
+
+            static void operator delete(void* pointer, size_t size) noexcept
+            {
+                FramePool::deallocate(pointer, size);
+            }
+
+        private:
+            std::coroutine_handle<> continuation;
+            std::exception_ptr exception;
+            bool detached = false;
+        };
+
+        ~Task()
+        {
+            if (handle) handle.destroy();
+        }
+
+        Task(const Task&) = delete;
+        Task& operator=(const Task&) = delete;
+
+        Task(Task&& other) noexcept:
+            handle(other.handle)
+        {
+            other.handle = nullptr;
+        }
+
+        Task& operator=(Task&& other) noexcept
+        {
+            if (&other != this)
+            {
+                if (handle) handle.destroy();
+                handle = other.handle;
+                other.handle = nullptr;
+            }
+
+            return *this;
+        }
+
+        // runs the task until its first suspension, the frame is destroyed when the task finishes
+        void start()
+        {
+            if (!handle)
+                throw std::runtime_error("Invalid task");
+
+            std::coroutine_handle<promise_type> startHandle = handle;
+            handle = nullptr;
+            startHandle.promise().detached = true;
+            startHandle.resume();
+        }
+
+        bool await_ready() const noexcept { return !handle || handle.done(); }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept
+        {
+            handle.promise().continuation = awaiter;
+            return handle;
+        }
+
+        void await_resume()
+        {
+            if (handle && handle.promise().exception)
+                std::rethrow_exception(handle.promise().exception);
+        }
+
+    private:
+        explicit Task(std::coroutine_handle<promise_type> aHandle) noexcept:
+            handle(aHandle)
+        {
+        }
+
+        std::coroutine_handle<promise_type> handle;
+    };
+
+    // Socket driven by awaitables, waiting coroutines are resumed directly from Network::update
+    class AsyncSocket final
+    {
+    public:
+        explicit AsyncSocket(Network& aNetwork):
+            socket(aNetwork)
+        {
+            init();
+        }
+
+        explicit AsyncSocket(Socket&& aSocket):
+            socket(std::move(aSocket))
+        {
+            init();
+        }
+
+        // the socket callbacks refer to this object
+        AsyncSocket(const AsyncSocket&) = delete;
+        AsyncSocket& operator=(const AsyncSocket&) = delete;
+
+        Socket& getSocket() { return socket; }
+        const Socket& getSocket() const { return socket; }
+
+        // the last I/O error, which closed the socket or failed the connect
+        const std::error_code& getError() const { return error; }
+
+        class ConnectAwaiter final
+        {
+        public:
+            ConnectAwaiter(AsyncSocket& aOwner, std::string aAddress):
+                owner(aOwner), address(std::move(aAddress))
+            {
+            }
+
+            bool await_ready() const noexcept { return false; }
+
+            bool await_suspend(std::coroutine_handle<> handle)
+            {
+                owner.connectFinished = false;
+                owner.connectResult = false;
+                owner.error.clear();
+                owner.connectStarting = true;
+
+                try
+                {
+                    owner.socket.connect(address);
+                }
+                catch (...)
+                {
+                    owner.connectStarting = false;
+                    throw;
+                }
+
+                owner.connectStarting = false;
+
+                // the connect callbacks can be called before connect returns
+                if (owner.connectFinished)
+                    return false;
+
+                owner.connectWaiter = handle;
+                return true;
+            }
+
+            bool await_resume() const noexcept { return owner.connectResult; }
+
+        private:
+            AsyncSocket& owner;
+            std::string address;
+        };
+
+        class AcceptAwaiter final
+        {
+        public:
+            explicit AcceptAwaiter(AsyncSocket& aOwner):
+                owner(aOwner)
+            {
+            }
+
+            bool await_ready() const noexcept { return !owner.acceptedSockets.empty(); }
+
+            void await_suspend(std::coroutine_handle<> handle) noexcept
+            {
+                owner.acceptWaiter = handle;
+            }
+
+            Socket await_resume()
+            {
+                Socket result = std::move(owner.acceptedSockets.front());
+                owner.acceptedSockets.pop_front();
+                return result;
+            }
+
+        private:
+            AsyncSocket& owner;
+        };
+
+        class ReadAwaiter final
+        {
+        public:
+            ReadAwaiter(AsyncSocket& aOwner, std::vector<uint8_t>& aBuffer):
+                owner(aOwner), buffer(aBuffer)
+            {
+            }
+
+            bool await_ready()
+            {
+                if (!owner.inData.empty())
+                {
+                    buffer.swap(owner.inData);
+                    owner.inData.clear();
+                    return true;
+                }
+
+                if (!owner.socket.isReady())
+                {
+                    // a closed socket resumes with 0 instead of the size of the previous read
+                    buffer.clear();
+                    return true;
+                }
+
+                return false;
+            }
+
+            void await_suspend(std::coroutine_handle<> handle) noexcept
+            {
+                buffer.clear();
+                owner.readBuffer = &buffer;
+                owner.readWaiter = handle;
+            }
+
+            size_t await_resume() const noexcept { return buffer.size(); }
+
+        private:
+            AsyncSocket& owner;
+            std::vector<uint8_t>& buffer;
+        };
+
+        class WriteAwaiter final
+        {
+        public:
+            WriteAwaiter(AsyncSocket& aOwner, std::vector<uint8_t> aData):
+                owner(aOwner), data(std::move(aData))
+            {
+            }
+
+            bool await_ready()
+            {
+                if (!owner.socket.isReady())
+                    return true;
+
+                owner.socket.send(std::move(data));
+                return !owner.socket.hasOutData();
+            }
+
+            void await_suspend(std::coroutine_handle<> handle) noexcept
+            {
+                owner.writeWaiter = handle;
+            }
+
+            bool await_resume() const noexcept { return owner.socket.isReady() && !owner.socket.hasOutData(); }
+
+        private:
+            AsyncSocket& owner;
+            std::vector<uint8_t> data;
+        };
+
+        // resumes with true when connected and false if the connection failed or timed out
+        ConnectAwaiter connect(const std::string& address)
+        {
+            return ConnectAwaiter(*this, address);
+        }
+
+        // resumes with the next client of a socket that has been started with startAccept
+        AcceptAwaiter accept()
+        {
+            return AcceptAwaiter(*this);
+        }
+
+        // replaces the contents of buffer with the received data and resumes with its size, 0 means the socket has been closed
+        ReadAwaiter readSome(std::vector<uint8_t>& buffer)
+        {
+            return ReadAwaiter(*this, buffer);
+        }
+
+        // resumes when all data has been written to the socket, false means the socket has been closed
+        WriteAwaiter writeAll(std::vector<uint8_t> data)
+        {
+            return WriteAwaiter(*this, std::move(data));
+        }
+
+    private:
+        void init()
+        {
+            socket.setReadCallback([this](Socket&, const std::vector<uint8_t>& data) {
+                if (readWaiter)
+                {
+                    readBuffer->assign(data.begin(), data.end());
+                    resume(readWaiter);
+                }
+                else
+                    inData.insert(inData.end(), data.begin(), data.end());
+            });
+
+            socket.setCloseCallback([this](Socket&) {
+                // a resumed coroutine can destroy this object
+                std::coroutine_handle<> readHandle = readWaiter;
+                std::coroutine_handle<> writeHandle = writeWaiter;
+                readWaiter = nullptr;
+                writeWaiter = nullptr;
+
+                if (readHandle) readHandle.resume();
+                if (writeHandle) writeHandle.resume();
+            });
+
+            socket.setAcceptCallback([this](Socket&, Socket& client) {
+                acceptedSockets.push_back(std::move(client));
+                if (acceptWaiter) resume(acceptWaiter);
+            });
+
+            socket.setConnectCallback([this](Socket&) {
+                finishConnect(true);
+            });
+
+            socket.setConnectErrorCallback([this](Socket&) {
+                finishConnect(false);
+            });
+
+            socket.setDrainCallback([this](Socket&) {
+                if (writeWaiter) resume(writeWaiter);
+            });
+
+            // errors are reported through the awaiter results instead of exceptions from Network::update
+            socket.setErrorCallback([this](Socket&, const std::error_code& newError) {
+                error = newError;
+            });
+        }
+
+        void finishConnect(bool result)
+        {
+            connectFinished = true;
+            connectResult = result;
+
+            // a connect that finishes inside ConnectAwaiter::await_suspend does not suspend the coroutine
+            if (!connectStarting && connectWaiter)
+                resume(connectWaiter);
+        }
+
+        static void resume(std::coroutine_handle<>& waiter)
+        {
+            std::coroutine_handle<> handle = waiter;
+            waiter = nullptr;
+            handle.resume();
+        }
+
+        Socket socket;
+
+        std::vector<uint8_t> inData;
+        std::vector<uint8_t>* readBuffer = nullptr;
+        std::deque<Socket> acceptedSockets;
+
+        std::coroutine_handle<> connectWaiter;
+        std::coroutine_handle<> acceptWaiter;
+        std::coroutine_handle<> readWaiter;
+        std::coroutine_handle<> writeWaiter;
+
+        std::error_code error;
+
+        bool connectStarting = false;
+        bool connectFinished = false;
+        bool connectResult = false;
+    };
+}
+
+#endif // CPPSOCKET_COROUTINE_HPP
@@ -0,0 +1,303 @@
+//
+//  cppsocket
+//
+
+#ifndef CPPSOCKET_HANDOFF_HPP
+#define CPPSOCKET_HANDOFF_HPP
+
+#ifdef _WIN32
+#  error "Handoff.hpp requires passing file descriptors over Unix domain sockets"
+#endif
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "Socket.hpp"
+
+namespace cppsocket
+{
+    // Unix domain socket connection that passes open sockets to another process with SCM_RIGHTS,
+    // e.g. the listeners of a server during a restart, so that no connection attempt is refused
+    class HandoffChannel final
+    {
+    public:
+        // the old process listens on path and waits for the new process to connect
+        static HandoffChannel listen(const std::string& path)
+        {
+            HandoffChannel channel(createFd());
+            sockaddr_un address = getAddress(path);
+
+            ::unlink(path.c_str());
+
+            if (bind(channel.fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0)
+                throw std::system_error(errno, std::system_category(), "Failed to bind handoff socket to " + path);
+
+            if (::listen(channel.fd, 1) < 0)
+                throw std::system_error(errno, std::system_category(), "Failed to listen on handoff socket " + path);
+
+            channel.path = path;
+
+            return channel;
+        }
+
+        static HandoffChannel connect(const std::string& path)
+        {
+            HandoffChannel channel(createFd());
+            sockaddr_un address = getAddress(path);
+
+            if (::connect(channel.fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0)
+                throw std::system_error(errno, std::system_category(), "Failed to connect to handoff socket " + path);
+
+            return channel;
+        }
+
+        ~HandoffChannel()
+        {
+            if (fd != NULL_SOCKET) ::close(fd);
+            if (!path.empty()) ::unlink(path.c_str());
+        }
+
+        HandoffChannel(const HandoffChannel&) = delete;
+        HandoffChannel& operator=(const HandoffChannel&) = delete;
+
+        HandoffChannel(HandoffChannel&& other) noexcept:
+            fd(other.fd), path(std::move(other.path))
+        {
+            other.fd = NULL_SOCKET;
+            other.path.clear();
+        }
+
+        HandoffChannel& operator=(HandoffChannel&& other) noexcept
+        {
+            if (&other != this)
+            {
+                if (fd != NULL_SOCKET) ::close(fd);
+                if (!path.empty()) ::unlink(path.c_str());
+                fd = other.fd;
+                path = std::move(other.path);
+                other.fd = NULL_SOCKET;
+                other.path.clear();
+            }
+
+            return *this;
+        }
+
+        // blocks until the new process connects to a channel created with listen
+        HandoffChannel accept()
+        {
+            socket_t clientFd = ::accept(fd, nullptr, nullptr);
+
+            if (clientFd == NULL_SOCKET)
+                throw std::system_error(errno, std::system_category(), "Failed to accept handoff connection");
+
+            return HandoffChannel(clientFd);
+        }
+
+        // passes the socket and its unsent data to the other process and closes it in this one,
+        // the connection itself stays open, because the other process holds the descriptor
+        void send(Socket& socket)
+        {
+            if (socket.socketFd == NULL_SOCKET)
+                throw std::runtime_error("Invalid socket");
+
+#if defined(__linux__) && defined(SO_ZEROCOPY)
+            // the buffers can only be freed once the kernel is done with them and
+            // the other process must not receive the completions of this one
+            socket.waitForZeroCopyCompletions(ZERO_COPY_LINGER_TIME);
+#endif
+
+            std::vector<uint8_t> data;
+
+            if (socket.zeroCopyPending)
+            {
+                const Socket::ZeroCopyBuffer& buffer = socket.cold->zeroCopyBuffers.back();
+                data.assign(buffer.data.begin() + static_cast<std::ptrdiff_t>(buffer.offset), buffer.data.end());
+            }
+
+            data.insert(data.end(), socket.outData.begin(), socket.outData.end());
+
+            Header header;
+            header.magic = MAGIC;
+            header.dataSize = static_cast<uint32_t>(data.size());
+
+            iovec vector;
+            vector.iov_base = &header;
+            vector.iov_len = sizeof(header);
+
+            alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+            memset(control, 0, sizeof(control));
+
+            msghdr message;
+            memset(&message, 0, sizeof(message));
+            message.msg_iov = &vector;
+            message.msg_iovlen = 1;
+            message.msg_control = control;
+            message.msg_controllen = sizeof(control);
+
+            cmsghdr* controlHeader = CMSG_FIRSTHDR(&message);
+            controlHeader->cmsg_level = SOL_SOCKET;
+            controlHeader->cmsg_type = SCM_RIGHTS;
+            controlHeader->cmsg_len = CMSG_LEN(sizeof(int));
+            memcpy(CMSG_DATA(controlHeader), &socket.socketFd, sizeof(int));
+
+            if (sendmsg(fd, &message, 0) != static_cast<ssize_t>(sizeof(header)))
+                throw std::system_error(errno, std::system_category(), "Failed to send socket over handoff channel");
+
+            writeAll(data.data(), data.size());
+
+            // the data now belongs to the other process, so close must not flush it
+            socket.clearOutData();
+            socket.close();
+        }
+
+        // returns the next socket sent by the other process or nullptr once it has closed the channel
+        std::unique_ptr<Socket> receive(Network& network)
+        {
+            Header header;
+
+            iovec vector;
+            vector.iov_base = &header;
+            vector.iov_len = sizeof(header);
+
+            alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+
+            msghdr message;
+            memset(&message, 0, sizeof(message));
+            message.msg_iov = &vector;
+            message.msg_iovlen = 1;
+            message.msg_control = control;
+            message.msg_controllen = sizeof(control);
+
+            ssize_t size = recvmsg(fd, &message, MSG_WAITALL);
+
+            if (size == 0)
+                return nullptr;
+
+            if (size < 0)
+                throw std::system_error(errno, std::system_category(), "Failed to receive socket over handoff channel");
+
+            socket_t socketFd = NULL_SOCKET;
+
+            for (cmsghdr* controlHeader = CMSG_FIRSTHDR(&message); controlHeader; controlHeader = CMSG_NXTHDR(&message, controlHeader))
+                if (controlHeader->cmsg_level == SOL_SOCKET && controlHeader->cmsg_type == SCM_RIGHTS)
+                    memcpy(&socketFd, CMSG_DATA(controlHeader), sizeof(int));
+
+            if (socketFd == NULL_SOCKET)
+                throw std::runtime_error("Handoff message without a socket");
+
+            if (size != static_cast<ssize_t>(sizeof(header)) || header.magic != MAGIC)
+            {
+                ::close(socketFd);
+                throw std::runtime_error("Invalid handoff message");
+            }
+
+            std::vector<uint8_t> data(header.dataSize);
+
+            std::unique_ptr<Socket> socket;
+
+            try
+            {
+                readAll(data.data(), data.size());
+                socket.reset(new Socket(network, socketFd));
+            }
+            catch (...)
+            {
+                ::close(socketFd);
+                throw;
+            }
+
+            socket->outData = std::move(data);
+
+            return socket;
+        }
+
+        socket_t getFd() const { return fd; }
+
+    private:
+        static constexpr uint32_t MAGIC = 0x48535043; // "CPSH"
+
+        struct Header
+        {
+            uint32_t magic;
+            uint32_t dataSize;
+        };
+
+        explicit HandoffChannel(socket_t aFd):
+            fd(aFd)
+        {
+        }
+
+        static socket_t createFd()
+        {
+            socket_t result = socket(AF_UNIX, SOCK_STREAM, 0);
+
+            if (result == NULL_SOCKET)
+                throw std::system_error(errno, std::system_category(), "Failed to create handoff socket");
+
+            return result;
+        }
+
+        static sockaddr_un getAddress(const std::string& path)
+        {
+            sockaddr_un address;
+            memset(&address, 0, sizeof(address));
+            address.sun_family = AF_UNIX;
+
+            if (path.size() >= sizeof(address.sun_path))
+                throw std::runtime_error("Handoff socket path too long: " + path);
+
+            memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+            return address;
+        }
+
+        void writeAll(const uint8_t* data, size_t size)
+        {
+            while (size > 0)
+            {
+                ssize_t written = ::write(fd, data, size);
+
+                if (written < 0)
+                {
+                    if (errno == EINTR) continue;
+                    throw std::system_error(errno, std::system_category(), "Failed to write to handoff channel");
+                }
+
+                data += written;
+                size -= static_cast<size_t>(written);
+            }
+        }
+
+        void readAll(uint8_t* data, size_t size)
+        {
+            while (size > 0)
+            {
+                ssize_t result = ::read(fd, data, size);
+
+                if (result == 0)
+                    throw std::runtime_error("Handoff channel closed in the middle of a message");
+
+                if (result < 0)
+                {
+                    if (errno == EINTR) continue;
+                    throw std::system_error(errno, std::system_category(), "Failed to read from handoff channel");
+                }
+
+                data += result;
+                size -= static_cast<size_t>(result);
+            }
+        }
+
+        socket_t fd = NULL_SOCKET;
+        std::string path;
+    };
+}
+
+#endif // CPPSOCKET_HANDOFF_HPP
@@ -0,0 +1,86 @@
+//
+//  cppsocket
+//
+
+#ifndef CPPSOCKET_LOADBALANCER_HPP
+#define CPPSOCKET_LOADBALANCER_HPP
+
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+#include "Socket.hpp"
+
+namespace cppsocket
+{
+    // spreads the connections of networks running on different threads by their socket counts,
+    // each network needs an adopt callback that takes over the sockets migrated to it
+    class LoadBalancer final
+    {
+    public:
+        // a socket is only migrated if its network has more than threshold sockets more than the least loaded one,
+        // so that connections do not bounce between networks with similar loads
+        explicit LoadBalancer(size_t aThreshold = 2):
+            threshold(aThreshold)
+        {
+        }
+
+        // the networks have to be added before their threads start
+        void addNetwork(Network& network)
+        {
+            networks.push_back(&network);
+        }
+
+        size_t getThreshold() const { return threshold; }
+        void setThreshold(size_t newThreshold) { threshold = newThreshold; }
+
+        // the network with the fewest sockets, e.g. for a client that has just been accepted
+        Network& getLeastLoaded() const
+        {
+            if (networks.empty())
+                throw std::runtime_error("No networks to balance");
+
+            Network* result = networks.front();
+            size_t resultCount = result->getSocketCount();
+
+            for (Network* network : networks)
+            {
+                const size_t count = network->getSocketCount();
+
+                if (count < resultCount)
+                {
+                    result = network;
+                    resultCount = count;
+                }
+            }
+
+            return *result;
+        }
+
+        // migrates the socket to the least loaded network if its own network is overloaded and releases it,
+        // has to be called on the thread of the network of the socket, e.g. periodically for each of its connections
+        bool rebalance(std::unique_ptr<Socket>& socket)
+        {
+            if (!socket || !socket->isReady())
+                return false;
+
+            Network& source = socket->getNetwork();
+            Network& target = getLeastLoaded();
+
+            if (&target == &source ||
+                source.getSocketCount() <= target.getSocketCount() + threshold)
+                return false;
+
+            socket->migrate(target);
+            socket.reset();
+
+            return true;
+        }
+
+    private:
+        size_t threshold;
+        std::vector<Network*> networks;
+    };
+}
+
+#endif // CPPSOCKET_LOADBALANCER_HPP
@@ -0,0 +1,737 @@
+//
+//  cppsocket
+//
+
+#ifndef CPPSOCKET_MEMORYTRANSPORT_HPP
+#define CPPSOCKET_MEMORYTRANSPORT_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <set>
+#include <system_error>
+#include <utility>
+#include <vector>
+#include "Socket.hpp"
+
+namespace cppsocket
+{
+    // Transport that connects sockets in memory without system calls, for deterministic tests and for benchmarking
+    // the code above the kernel, connections are only possible between sockets of the same transport,
+    // partial reads and writes, errors and resets can be scripted per descriptor, the wakers are memory descriptors too,
+    // descriptors of other transports are passed on to the system poll, which a wake can not interrupt
+    class MemoryTransport final: public Transport
+    {
+    public:
+        // the amount of data an endpoint can hold before sends to it would block
+        size_t getBufferSize() const { return bufferSize; }
+        void setBufferSize(size_t newBufferSize) { bufferSize = newBufferSize; }
+
+        // creates two connected endpoints, e.g. for sockets adopted with Socket(Network&, socket_t)
+        std::pair<socket_t, socket_t> createPair()
+        {
+            socket_t first = createEndpoint();
+            socket_t second = createEndpoint();
+
+            Endpoint& firstEndpoint = endpoints[first];
+            Endpoint& secondEndpoint = endpoints[second];
+            firstEndpoint.localAddress = secondEndpoint.localAddress = htonl(INADDR_LOOPBACK);
+            firstEndpoint.localPort = allocatePort();
+            secondEndpoint.localPort = allocatePort();
+            link(first, second);
+
+            return std::make_pair(first, second);
+        }
+
+        // the next send on fd writes at most size bytes
+        void limitSend(socket_t fd, size_t size)
+        {
+            getEndpoint(fd).sendSteps.push_back(Step(size, 0));
+        }
+
+        // the next send on fd fails with error, e.g. EWOULDBLOCK or ECONNRESET
+        void failSend(socket_t fd, int error)
+        {
+            getEndpoint(fd).sendSteps.push_back(Step(0, error));
+        }
+
+        // the next recv on fd reads at most size bytes
+        void limitReceive(socket_t fd, size_t size)
+        {
+            getEndpoint(fd).receiveSteps.push_back(Step(size, 0));
+        }
+
+        // the next recv on fd fails with error, the descriptor is reported as readable until then
+        void failReceive(socket_t fd, int error)
+        {
+            getEndpoint(fd).receiveSteps.push_back(Step(0, error));
+        }
+
+        // resets the connection of fd, the queued data is dropped and both endpoints fail with ECONNRESET
+        void reset(socket_t fd)
+        {
+            Endpoint& endpoint = getEndpoint(fd);
+
+            if (endpoint.peer != NULL_SOCKET)
+            {
+                Endpoint& peer = getEndpoint(endpoint.peer);
+                peer.inData.clear();
+                peer.error = Errors::CONNECTION_RESET;
+                peer.peerClosed = true;
+                peer.peer = NULL_SOCKET;
+            }
+
+            endpoint.inData.clear();
+            endpoint.error = Errors::CONNECTION_RESET;
+            endpoint.peerClosed = true;
+            endpoint.peer = NULL_SOCKET;
+        }
+
+        // number of bytes received by fd that have not been read yet
+        size_t getPendingSize(socket_t fd) const
+        {
+            auto i = endpoints.find(fd);
+            return (i == endpoints.end()) ? 0 : i->second.inData.size();
+        }
+
+        socket_t socket(int domain, int type, int) override
+        {
+            if (domain != PF_INET || type != SOCK_STREAM)
+            {
+                setError(Errors::INVALID);
+                return NULL_SOCKET;
+            }
+
+            return createEndpoint();
+        }
+
+        int close(socket_t fd) override
+        {
+            auto i = endpoints.find(fd);
+
+            if (i == endpoints.end())
+                return fail(Errors::BAD_DESCRIPTOR);
+
+            Endpoint& endpoint = i->second;
+
+            if (endpoint.listening)
+            {
+                listeners.erase(std::make_pair(endpoint.localAddress, endpoint.localPort));
+
+                // clients that have not been accepted see the connection closed
+                for (socket_t client : endpoint.pendingClients)
+                    close(client);
+            }
+
+            if (endpoint.peer != NULL_SOCKET)
+            {
+                Endpoint& peer = endpoints[endpoint.peer];
+                peer.peerClosed = true;
+                peer.peer = NULL_SOCKET;
+            }
+
+            endpoints.erase(fd);
+
+            return 0;
+        }
+
+        int bind(socket_t fd, const sockaddr* address, socklen_t addressLength) override
+        {
+            auto i = endpoints.find(fd);
+
+            if (i == endpoints.end())
+                return fail(Errors::BAD_DESCRIPTOR);
+
+            if (addressLength < static_cast<socklen_t>(sizeof(sockaddr_in)) || address->sa_family != AF_INET)
+                return fail(Errors::INVALID);
+
+            const sockaddr_in* addr = reinterpret_cast<const sockaddr_in*>(address);
+            i->second.localAddress = addr->sin_addr.s_addr;
+            i->second.localPort = ntohs(addr->sin_port);
+
+            if (!i->second.localPort)
+                i->second.localPort = allocatePort();
+
+            i->second.bound = true;
+
+            return 0;
+        }
+
+        int listen(socket_t fd, int backlog) override
+        {
+            auto i = endpoints.find(fd);
+
+            if (i == endpoints.end())
+                return fail(Errors::BAD_DESCRIPTOR);
+
+            Endpoint& endpoint = i->second;
+
+            if (!endpoint.bound)
+            {
+                endpoint.localPort = allocatePort();
+                endpoint.bound = true;
+            }
+
+            const std::pair<uint32_t, uint16_t> key(endpoint.localAddress, endpoint.localPort);
+
+            if (listeners.find(key) != listeners.end())
+                return fail(Errors::ADDRESS_IN_USE);
+
+            listeners[key] = fd;
+            endpoint.listening = true;
+            endpoint.backlog = static_cast<size_t>(std::max(backlog, 1));
+
+            return 0;
+        }
+
+        socket_t accept(socket_t fd, sockaddr* address, socklen_t* addressLength) override
+        {
+            auto i = endpoints.find(fd);
+
+            if (i == endpoints.end())
+            {
+                setError(Errors::BAD_DESCRIPTOR);
+                return NULL_SOCKET;
+            }
+
+            Endpoint& endpoint = i->second;
+
+            if (!endpoint.listening)
+            {
+                setError(Errors::INVALID);
+                return NULL_SOCKET;
+            }
+
+            if (endpoint.pendingClients.empty())
+            {
+                setError(Errors::WOULD_BLOCK);
+                return NULL_SOCKET;
+            }
+
+            socket_t client = endpoint.pendingClients.front();
+            endpoint.pendingClients.pop_front();
+
+            const Endpoint& clientEndpoint = endpoints[client];
+            fillAddress(address, addressLength, clientEndpoint.remoteAddress, clientEndpoint.remotePort);
+
+            return client;
+        }
+
+        // connects immediately or fails with ECONNREFUSED if nobody listens on the address
+        int connect(socket_t fd, const sockaddr* address, socklen_t addressLength) override
+        {
+            auto i = endpoints.find(fd);
+
+            if (i == endpoints.end())
+                return fail(Errors::BAD_DESCRIPTOR);
+
+            if (addressLength < static_cast<socklen_t>(sizeof(sockaddr_in)) || address->sa_family != AF_INET)
+                return fail(Errors::INVALID);
+
+            if (i->second.peer != NULL_SOCKET || i->second.listening)
+                return fail(Errors::ALREADY_CONNECTED);
+
+            const sockaddr_in* addr = reinterpret_cast<const sockaddr_in*>(address);
+            const uint16_t port = ntohs(addr->sin_port);
+
+            auto listener = listeners.find(std::make_pair(static_cast<uint32_t>(addr->sin_addr.s_addr), port));
+
+            if (listener == listeners.end())
+                listener = listeners.find(std::make_pair(static_cast<uint32_t>(ANY_ADDRESS), port));
+
+            if (listener == listeners.end() ||
+                endpoints[listener->second].pendingClients.size() >= endpoints[listener->second].backlog)
+                return fail(Errors::CONNECTION_REFUSED);
+
+            if (!i->second.bound)
+            {
+                i->second.localAddress = addr->sin_addr.s_addr;
+                i->second.localPort = allocatePort();
+                i->second.bound = true;
+            }
+
+            socket_t server = createEndpoint();
+            Endpoint& serverEndpoint = endpoints[server];
+            serverEndpoint.localAddress = addr->sin_addr.s_addr;
+            serverEndpoint.localPort = port;
+            serverEndpoint.bound = true;
+
+            link(fd, server);
+            endpoints[listener->second].pendingClients.push_back(server);
+
+            return 0;
+        }
+
+        ssize_t send(socket_t fd, const void* data, size_t size, int) override
+        {
+            auto i = endpoints.find(fd);
+
+            if (i == endpoints.end())
+                return fail(Errors::BAD_DESCRIPTOR);
+
+            Endpoint& endpoint = i->second;
+            size_t limit = std::numeric_limits<size_t>::max();
+
+            if (!endpoint.sendSteps.empty())
+            {
+                const Step step = endpoint.sendSteps.front();
+                endpoint.sendSteps.pop_front();
+
+                if (step.error)
+                    return fail(step.error);
+
+                limit = step.size;
+            }
+
+            if (endpoint.error)
+                return fail(takeError(endpoint));
+
+            if (endpoint.peer == NULL_SOCKET)
+                return fail(endpoint.peerClosed ? Errors::BROKEN_PIPE : Errors::NOT_CONNECTED);
+
+            Endpoint& peer = endpoints[endpoint.peer];
+
+            if (size == 0)
+                return 0;
+
+            const size_t room = (peer.inData.size() < bufferSize) ? bufferSize - peer.inData.size() : 0;
+
+            if (room == 0)
+                return fail(Errors::WOULD_BLOCK);
+
+            const size_t count = std::min(std::min(size, limit), room);
+            const uint8_t* bytes = static_cast<const uint8_t*>(data);
+            peer.inData.insert(peer.inData.end(), bytes, bytes + count);
+
+            return static_cast<ssize_t>(count);
+        }
+
+        ssize_t recv(socket_t fd, void* data, size_t size, int) override
+        {
+            auto i = endpoints.find(fd);
+
+            if (i == endpoints.end())
+                return fail(Errors::BAD_DESCRIPTOR);
+
+            Endpoint& endpoint = i->second;
+            size_t limit = std::numeric_limits<size_t>::max();
+
+            if (!endpoint.receiveSteps.empty())
+            {
+                const Step step = endpoint.receiveSteps.front();
+                endpoint.receiveSteps.pop_front();
+
+                if (step.error)
+                    return fail(step.error);
+
+                limit = step.size;
+            }
+
+            if (endpoint.error)
+                return fail(takeError(endpoint));
+
+            if (!endpoint.inData.empty())
+            {
+                const size_t count = std::min(std::min(size, limit), endpoint.inData.size());
+                std::copy(endpoint.inData.begin(), endpoint.inData.begin() + static_cast<std::ptrdiff_t>(count),
+                          static_cast<uint8_t*>(data));
+                endpoint.inData.erase(endpoint.inData.begin(), endpoint.inData.begin() + static_cast<std::ptrdiff_t>(count));
+
+                return static_cast<ssize_t>(count);
+            }
+
+            if (endpoint.peerClosed)
+                return 0;
+
+            if (endpoint.peer == NULL_SOCKET && !endpoint.listening)
+                return fail(Errors::NOT_CONNECTED);
+
+            return fail(Errors::WOULD_BLOCK);
+        }
+
+        // never waits for the endpoints, nothing can change them while poll blocks, only a wake from another thread can,
+        // it waits for the wakers if none of the memory descriptors is ready and for the other descriptors if there are any
+        int poll(pollfd* fds, size_t count, int timeout) override
+        {
+            int result = 0;
+            systemPollFds.clear();
+            systemPollIndices.clear();
+            wakerPollIndices.clear();
+
+            std::unique_lock<std::mutex> lock(wakeMutex);
+
+            for (size_t index = 0; index < count; ++index)
+            {
+                pollfd& pollFd = fds[index];
+                auto i = endpoints.find(pollFd.fd);
+
+                if (i != endpoints.end())
+                {
+                    pollFd.revents = static_cast<short>(getEvents(i->second) & (pollFd.events | POLLERR | POLLHUP));
+                }
+                else if (wakers.find(pollFd.fd) != wakers.end())
+                {
+                    pollFd.revents = (wokenWakers.find(pollFd.fd) != wokenWakers.end()) ?
+                        static_cast<short>(pollFd.events & POLLIN) : 0;
+                    wakerPollIndices.push_back(index);
+                }
+                else
+                {
+                    systemPollFds.push_back(pollFd);
+                    systemPollIndices.push_back(index);
+                    continue;
+                }
+
+                if (pollFd.revents)
+                    ++result;
+            }
+
+            if (!result && timeout != 0 && systemPollFds.empty() && !wakerPollIndices.empty())
+            {
+                auto woken = [this, fds]() {
+                    for (size_t index : wakerPollIndices)
+                        if (wokenWakers.find(fds[index].fd) != wokenWakers.end())
+                            return true;
+
+                    return false;
+                };
+
+                if (timeout < 0)
+                    wakeCondition.wait(lock, woken);
+                else
+                    wakeCondition.wait_for(lock, std::chrono::milliseconds(timeout), woken);
+
+                for (size_t index : wakerPollIndices)
+                {
+                    pollfd& pollFd = fds[index];
+                    pollFd.revents = (wokenWakers.find(pollFd.fd) != wokenWakers.end()) ?
+                        static_cast<short>(pollFd.events & POLLIN) : 0;
+
+                    if (pollFd.revents)
+                        ++result;
+                }
+            }
+
+            lock.unlock();
+
+            if (!systemPollFds.empty())
+            {
+#ifdef _WIN32
+                int systemResult = WSAPoll(systemPollFds.data(), static_cast<ULONG>(systemPollFds.size()), result ? 0 : timeout);
+#else
+                int systemResult = ::poll(systemPollFds.data(), static_cast<nfds_t>(systemPollFds.size()), result ? 0 : timeout);
+#endif
+
+                if (systemResult < 0)
+                    return systemResult;
+
+                for (size_t index = 0; index < systemPollFds.size(); ++index)
+                    fds[systemPollIndices[index]].revents = systemPollFds[index].revents;
+
+                result += systemResult;
+            }
+
+            return result;
+        }
+
+        int getsockname(socket_t fd, sockaddr* address, socklen_t* addressLength) override
+        {
+            auto i = endpoints.find(fd);
+
+            if (i == endpoints.end())
+                return fail(Errors::BAD_DESCRIPTOR);
+
+            fillAddress(address, addressLength, i->second.localAddress, i->second.localPort);
+
+            return 0;
+        }
+
+        int getpeername(socket_t fd, sockaddr* address, socklen_t* addressLength) override
+        {
+            auto i = endpoints.find(fd);
+
+            if (i == endpoints.end())
+                return fail(Errors::BAD_DESCRIPTOR);
+
+            if (i->second.peer == NULL_SOCKET)
+                return fail(Errors::NOT_CONNECTED);
+
+            fillAddress(address, addressLength, i->second.remoteAddress, i->second.remotePort);
+
+            return 0;
+        }
+
+        int setsockopt(socket_t fd, int level, int name, const void*, socklen_t) override
+        {
+            if (endpoints.find(fd) == endpoints.end())
+                return fail(Errors::BAD_DESCRIPTOR);
+
+            if (level == SOL_SOCKET && name == SO_REUSEADDR)
+                return 0;
+
+#ifdef __APPLE__
+            if (level == SOL_SOCKET && name == SO_NOSIGPIPE)
+                return 0;
+#endif
+
+            return fail(Errors::NO_PROTOCOL_OPTION);
+        }
+
+        int getsockopt(socket_t fd, int level, int name, void* value, socklen_t* valueLength) override
+        {
+            auto i = endpoints.find(fd);
+
+            if (i == endpoints.end())
+                return fail(Errors::BAD_DESCRIPTOR);
+
+            if (level != SOL_SOCKET || (name != SO_ERROR && name != SO_ACCEPTCONN))
+                return fail(Errors::NO_PROTOCOL_OPTION);
+
+            if (*valueLength < static_cast<socklen_t>(sizeof(int)))
+                return fail(Errors::INVALID);
+
+            const int result = (name == SO_ERROR) ? takeError(i->second) : (i->second.listening ? 1 : 0);
+            memcpy(value, &result, sizeof(result));
+            *valueLength = sizeof(result);
+
+            return 0;
+        }
+
+        // memory descriptors never block, the mode is only remembered
+        void setBlocking(socket_t fd, bool block) override
+        {
+            getEndpoint(fd).blocking = block;
+        }
+
+        bool isBlocking(socket_t fd) override
+        {
+            return getEndpoint(fd).blocking;
+        }
+
+        socket_t createWaker() override
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            socket_t fd = nextFd++;
+            wakers.insert(fd);
+            return fd;
+        }
+
+        void closeWaker(socket_t fd) override
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            wakers.erase(fd);
+            wokenWakers.erase(fd);
+        }
+
+        void wake(socket_t fd) override
+        {
+            {
+                std::lock_guard<std::mutex> lock(wakeMutex);
+
+                if (wakers.find(fd) == wakers.end())
+                    return;
+
+                wokenWakers.insert(fd);
+            }
+
+            wakeCondition.notify_all();
+        }
+
+        void drainWaker(socket_t fd) override
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            wokenWakers.erase(fd);
+        }
+
+    private:
+        // far above the descriptors the system hands out
+        static constexpr socket_t FIRST_FD = 0x40000000;
+
+        struct Errors
+        {
+#ifdef _WIN32
+            static constexpr int WOULD_BLOCK = WSAEWOULDBLOCK;
+            static constexpr int CONNECTION_RESET = WSAECONNRESET;
+            static constexpr int CONNECTION_REFUSED = WSAECONNREFUSED;
+            static constexpr int NOT_CONNECTED = WSAENOTCONN;
+            static constexpr int ALREADY_CONNECTED = WSAEISCONN;
+            static constexpr int BROKEN_PIPE = WSAESHUTDOWN;
+            static constexpr int BAD_DESCRIPTOR = WSAENOTSOCK;
+            static constexpr int INVALID = WSAEINVAL;
+            static constexpr int ADDRESS_IN_USE = WSAEADDRINUSE;
+            static constexpr int NO_PROTOCOL_OPTION = WSAENOPROTOOPT;
+#else
+            static constexpr int WOULD_BLOCK = EWOULDBLOCK;
+            static constexpr int CONNECTION_RESET = ECONNRESET;
+            static constexpr int CONNECTION_REFUSED = ECONNREFUSED;
+            static constexpr int NOT_CONNECTED = ENOTCONN;
+            static constexpr int ALREADY_CONNECTED = EISCONN;
+            static constexpr int BROKEN_PIPE = EPIPE;
+            static constexpr int BAD_DESCRIPTOR = EBADF;
+            static constexpr int INVALID = EINVAL;
+            static constexpr int ADDRESS_IN_USE = EADDRINUSE;
+            static constexpr int NO_PROTOCOL_OPTION = ENOPROTOOPT;
+#endif
+        };
+
+        struct Step
+        {
+            Step(size_t aSize, int aError):
+                size(aSize), error(aError)
+            {
+            }
+
+            size_t size;
+            int error;
+        };
+
+        struct Endpoint
+        {
+            bool bound = false;
+            bool listening = false;
+            bool blocking = true;
+            bool peerClosed = false;
+            int error = 0;
+
+            uint32_t localAddress = 0;
+            uint16_t localPort = 0;
+            uint32_t remoteAddress = 0;
+            uint16_t remotePort = 0;
+
+            socket_t peer = NULL_SOCKET;
+            std::deque<uint8_t> inData;
+
+            size_t backlog = 0;
+            std::deque<socket_t> pendingClients;
+
+            std::deque<Step> sendSteps;
+            std::deque<Step> receiveSteps;
+        };
+
+        socket_t createEndpoint()
+        {
+            socket_t fd = nextFd++;
+            endpoints[fd];
+            return fd;
+        }
+
+        Endpoint& getEndpoint(socket_t fd)
+        {
+            auto i = endpoints.find(fd);
+
+            if (i == endpoints.end())
+                throw std::system_error(Errors::BAD_DESCRIPTOR, std::system_category(), "Invalid memory socket");
+
+            return i->second;
+        }
+
+        void link(socket_t first, socket_t second)
+        {
+            Endpoint& firstEndpoint = endpoints[first];
+            Endpoint& secondEndpoint = endpoints[second];
+
+            firstEndpoint.peer = second;
+            firstEndpoint.remoteAddress = secondEndpoint.localAddress;
+            firstEndpoint.remotePort = secondEndpoint.localPort;
+
+            secondEndpoint.peer = first;
+            secondEndpoint.remoteAddress = firstEndpoint.localAddress;
+            secondEndpoint.remotePort = firstEndpoint.localPort;
+        }
+
+        uint16_t allocatePort()
+        {
+            uint16_t port = nextPort++;
+            if (nextPort == 0) nextPort = 49152;
+            return port;
+        }
+
+        int getEvents(const Endpoint& endpoint) const
+        {
+            int events = 0;
+
+            if (endpoint.error)
+                events |= POLLERR | POLLIN | POLLOUT;
+
+            if (!endpoint.inData.empty() || !endpoint.pendingClients.empty() ||
+                (!endpoint.receiveSteps.empty() && endpoint.receiveSteps.front().error))
+                events |= POLLIN;
+
+            if (endpoint.peerClosed)
+                events |= POLLIN | POLLHUP;
+
+            if (endpoint.peer != NULL_SOCKET)
+            {
+                auto peer = endpoints.find(endpoint.peer);
+
+                if (peer != endpoints.end() && peer->second.inData.size() < bufferSize)
+                    events |= POLLOUT;
+            }
+
+            return events;
+        }
+
+        static int takeError(Endpoint& endpoint)
+        {
+            int error = endpoint.error;
+            endpoint.error = 0;
+            return error;
+        }
+
+        static void fillAddress(sockaddr* address, socklen_t* addressLength, uint32_t ip, uint16_t port)
+        {
+            if (!address || !addressLength)
+                return;
+
+            sockaddr_in addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = ip;
+            addr.sin_port = htons(port);
+
+            memcpy(address, &addr, std::min(static_cast<size_t>(*addressLength), sizeof(addr)));
+            *addressLength = sizeof(addr);
+        }
+
+        static void setError(int error)
+        {
+#ifdef _WIN32
+            WSASetLastError(error);
+#else
+            errno = error;
+#endif
+        }
+
+        static int fail(int error)
+        {
+            setError(error);
+            return -1;
+        }
+
+        size_t bufferSize = 4 * RECEIVE_BUFFER_SIZE;
+        socket_t nextFd = FIRST_FD;
+        uint16_t nextPort = 49152;
+
+        std::map<socket_t, Endpoint> endpoints;
+        std::map<std::pair<uint32_t, uint16_t>, socket_t> listeners;
+
+        // wake can be called from any thread, everything else belongs to the thread that polls
+        std::mutex wakeMutex;
+        std::condition_variable wakeCondition;
+        std::set<socket_t> wakers;
+        std::set<socket_t> wokenWakers;
+
+        // reused between polls
+        std::vector<pollfd> systemPollFds;
+        std::vector<size_t> systemPollIndices;
+        std::vector<size_t> wakerPollIndices;
+    };
+}
+
+#endif // CPPSOCKET_MEMORYTRANSPORT_HPP
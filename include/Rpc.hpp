@@ -0,0 +1,392 @@
+//
+//  cppsocket
+//
+
+#ifndef CPPSOCKET_RPC_HPP
+#define CPPSOCKET_RPC_HPP
+
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+#include "Socket.hpp"
+
+namespace cppsocket
+{
+    enum class RpcStatus
+    {
+        OK,
+        FAILED, // the peer replied with an error, the payload holds its message
+        TIMEOUT,
+        CLOSED // the connection was closed before the reply arrived
+    };
+
+    class RpcError final: public std::runtime_error
+    {
+    public:
+        RpcError(RpcStatus aStatus, const std::string& message):
+            std::runtime_error(message), status(aStatus)
+        {
+        }
+
+        RpcStatus getStatus() const { return status; }
+
+    private:
+        RpcStatus status;
+    };
+
+    // request/response protocol over a Socket, every frame is tagged with a correlation id, so that any number of
+    // requests can be in flight on one connection and the replies can arrive in any order,
+    // both sides can send requests, a frame is: payload size (4 bytes), id (4), method (2), type (1), reserved (1)
+    class RpcConnection final
+    {
+    public:
+        using Callback = std::function<void(RpcStatus, const std::vector<uint8_t>&)>;
+        using RequestHandler = std::function<void(RpcConnection&, uint32_t id, uint16_t method, const std::vector<uint8_t>&)>;
+
+        static constexpr size_t HEADER_SIZE = 12;
+        static constexpr size_t DEFAULT_MAX_FRAME_SIZE = 16 * 1024 * 1024;
+        static constexpr float DEFAULT_TIMEOUT = 10.0f;
+
+        explicit RpcConnection(Network& aNetwork):
+            socket(aNetwork)
+        {
+            init();
+        }
+
+        // e.g. a socket passed to the accept callback
+        explicit RpcConnection(Socket&& aSocket):
+            socket(std::move(aSocket))
+        {
+            init();
+        }
+
+        ~RpcConnection()
+        {
+            if (destroyed) *destroyed = true;
+
+            for (const auto& request : pendingRequests)
+                if (request.second.timer)
+                    socket.getNetwork().cancelTimer(request.second.timer);
+        }
+
+        // the socket callbacks and the timers refer to this object
+        RpcConnection(const RpcConnection&) = delete;
+        RpcConnection& operator=(const RpcConnection&) = delete;
+
+        Socket& getSocket() { return socket; }
+        const Socket& getSocket() const { return socket; }
+
+        void connect(const std::string& address)
+        {
+            error.clear();
+            socket.connect(address);
+        }
+        void close()
+        {
+            socket.close();
+            failPendingRequests();
+        }
+
+        float getDefaultTimeout() const { return defaultTimeout; }
+        // 0 disables the timeout
+        void setDefaultTimeout(float timeout) { defaultTimeout = timeout; }
+
+        size_t getMaxFrameSize() const { return maxFrameSize; }
+        // a larger frame is treated as a protocol error and closes the connection
+        void setMaxFrameSize(size_t newMaxFrameSize) { maxFrameSize = newMaxFrameSize; }
+
+        // called for every request, the handler replies with reply or replyError, immediately or later
+        void setRequestHandler(const RequestHandler& newRequestHandler) { requestHandler = newRequestHandler; }
+
+        // called after the pending requests have failed, the callback can destroy this object
+        void setCloseCallback(const std::function<void(RpcConnection&)>& newCloseCallback) { closeCallback = newCloseCallback; }
+
+        size_t getPendingRequestCount() const { return pendingRequests.size(); }
+
+        // the last I/O error, which closed the connection, e.g. for the close callback
+        const std::error_code& getError() const { return error; }
+
+        // sends a request and returns its id, the callback is called exactly once with the reply or the failure,
+        // a negative timeout uses the default timeout
+        uint32_t call(uint16_t method, const std::vector<uint8_t>& payload, const Callback& callback, float timeout = -1.0f)
+        {
+            if (!socket.isReady() && !socket.isConnecting())
+                throw std::runtime_error("RPC connection is not connected");
+
+            uint32_t id = nextId++;
+            if (!id) id = nextId++;
+
+            // sent before the request is registered, so that a failed send never calls the callback
+            sendFrame(id, method, FrameType::REQUEST, payload);
+
+            PendingRequest& request = pendingRequests[id];
+            request.callback = callback;
+
+            if (timeout < 0.0f) timeout = defaultTimeout;
+
+            if (timeout > 0.0f)
+            {
+                request.timer = socket.getNetwork().addTimer(timeout, [this, id]() {
+                    complete(id, RpcStatus::TIMEOUT, std::vector<uint8_t>(), false);
+                });
+            }
+
+            return id;
+        }
+
+        // like call, but the result is delivered through a future, which throws RpcError on failure,
+        // the future must not be waited for on the thread that runs the network
+        std::future<std::vector<uint8_t>> callFuture(uint16_t method, const std::vector<uint8_t>& payload, float timeout = -1.0f)
+        {
+            std::shared_ptr<std::promise<std::vector<uint8_t>>> promise = std::make_shared<std::promise<std::vector<uint8_t>>>();
+            std::future<std::vector<uint8_t>> result = promise->get_future();
+
+            call(method, payload, [promise](RpcStatus status, const std::vector<uint8_t>& reply) {
+                if (status == RpcStatus::OK)
+                    promise->set_value(reply);
+                else
+                    promise->set_exception(std::make_exception_ptr(RpcError(status, getStatusMessage(status, reply))));
+            }, timeout);
+
+            return result;
+        }
+
+        // completes the pending request locally with RpcStatus::CLOSED, a late reply is ignored
+        bool cancel(uint32_t id)
+        {
+            return complete(id, RpcStatus::CLOSED, std::vector<uint8_t>(), true);
+        }
+
+        void reply(uint32_t id, uint16_t method, const std::vector<uint8_t>& payload)
+        {
+            sendFrame(id, method, FrameType::RESPONSE, payload);
+        }
+
+        void replyError(uint32_t id, uint16_t method, const std::string& message)
+        {
+            sendFrame(id, method, FrameType::FAILURE, std::vector<uint8_t>(message.begin(), message.end()));
+        }
+
+    private:
+        enum class FrameType: uint8_t
+        {
+            REQUEST,
+            RESPONSE,
+            FAILURE
+        };
+
+        struct PendingRequest
+        {
+            Callback callback;
+            TimerId timer = 0;
+        };
+
+        void init()
+        {
+            socket.setReadCallback([this](Socket&, const std::vector<uint8_t>& data) {
+                receive(data);
+            });
+
+            socket.setCloseCallback([this](Socket&) {
+                failPendingRequests();
+            });
+
+            // a peer reset fails the pending requests instead of throwing from Network::update
+            socket.setErrorCallback([this](Socket&, const std::error_code& newError) {
+                error = newError;
+            });
+        }
+
+        void sendFrame(uint32_t id, uint16_t method, FrameType type, const std::vector<uint8_t>& payload)
+        {
+            if (payload.size() > maxFrameSize)
+                throw std::runtime_error("RPC payload too large");
+
+            std::vector<uint8_t> frame(HEADER_SIZE + payload.size());
+            writeUint32(frame.data(), static_cast<uint32_t>(payload.size()));
+            writeUint32(frame.data() + 4, id);
+            frame[8] = static_cast<uint8_t>(method >> 8);
+            frame[9] = static_cast<uint8_t>(method);
+            frame[10] = static_cast<uint8_t>(type);
+            frame[11] = 0;
+            std::copy(payload.begin(), payload.end(), frame.begin() + HEADER_SIZE);
+
+            socket.send(std::move(frame));
+        }
+
+        void receive(const std::vector<uint8_t>& data)
+        {
+            if (inOffset == inData.size())
+            {
+                inData.clear();
+                inOffset = 0;
+            }
+
+            inData.insert(inData.end(), data.begin(), data.end());
+
+            // the handlers and callbacks can destroy this object
+            bool wasDestroyed = false;
+            destroyed = &wasDestroyed;
+
+            while (inData.size() - inOffset >= HEADER_SIZE)
+            {
+                const uint8_t* header = inData.data() + inOffset;
+                const uint32_t size = readUint32(header);
+
+                if (size > maxFrameSize)
+                {
+                    destroyed = nullptr;
+                    close();
+                    return;
+                }
+
+                if (inData.size() - inOffset < HEADER_SIZE + size)
+                    break;
+
+                const uint32_t id = readUint32(header + 4);
+                const uint16_t method = static_cast<uint16_t>((header[8] << 8) | header[9]);
+                const FrameType type = static_cast<FrameType>(header[10]);
+
+                framePayload.assign(header + HEADER_SIZE, header + HEADER_SIZE + size);
+                inOffset += HEADER_SIZE + size;
+
+                if (type == FrameType::REQUEST)
+                {
+                    if (requestHandler)
+                        requestHandler(*this, id, method, framePayload);
+                    else
+                        replyError(id, method, "No request handler");
+                }
+                else
+                    complete(id, (type == FrameType::RESPONSE) ? RpcStatus::OK : RpcStatus::FAILED, framePayload, true);
+
+                if (wasDestroyed)
+                    return;
+            }
+
+            destroyed = nullptr;
+
+            // keeps the buffer from growing with a steady stream of partial frames
+            if (inOffset > 0 && inOffset >= inData.size() / 2)
+            {
+                inData.erase(inData.begin(), inData.begin() + static_cast<std::ptrdiff_t>(inOffset));
+                inOffset = 0;
+            }
+        }
+
+        // returns false if the request is no longer pending, e.g. because it has timed out
+        bool complete(uint32_t id, RpcStatus status, const std::vector<uint8_t>& reply, bool cancelTimer)
+        {
+            auto i = pendingRequests.find(id);
+
+            if (i == pendingRequests.end())
+                return false;
+
+            if (cancelTimer && i->second.timer)
+                socket.getNetwork().cancelTimer(i->second.timer);
+
+            Callback callback = std::move(i->second.callback);
+            pendingRequests.erase(i);
+
+            if (callback)
+                callback(status, reply);
+
+            return true;
+        }
+
+        void failPendingRequests()
+        {
+            Network& network = socket.getNetwork();
+            std::map<uint32_t, PendingRequest> failedRequests;
+            failedRequests.swap(pendingRequests);
+
+            inData.clear();
+            inOffset = 0;
+
+            for (const auto& request : failedRequests)
+                if (request.second.timer)
+                    network.cancelTimer(request.second.timer);
+
+            // the callbacks can destroy this object, so they only use the local copies
+            std::function<void(RpcConnection&)> closeHandler = closeCallback;
+            bool wasDestroyed = false;
+            bool* previousDestroyed = destroyed;
+            destroyed = &wasDestroyed;
+
+            const std::vector<uint8_t> empty;
+
+            for (const auto& request : failedRequests)
+                if (request.second.callback)
+                    request.second.callback(RpcStatus::CLOSED, empty);
+
+            if (wasDestroyed)
+            {
+                if (previousDestroyed) *previousDestroyed = true;
+                return;
+            }
+
+            destroyed = previousDestroyed;
+
+            if (closeHandler)
+                closeHandler(*this);
+        }
+
+        static std::string getStatusMessage(RpcStatus status, const std::vector<uint8_t>& reply)
+        {
+            switch (status)
+            {
+                case RpcStatus::OK: return "OK";
+                case RpcStatus::FAILED: return std::string(reply.begin(), reply.end());
+                case RpcStatus::TIMEOUT: return "RPC request timed out";
+                case RpcStatus::CLOSED: return "RPC connection closed";
+            }
+
+            return "Unknown RPC status";
+        }
+
+        static void writeUint32(uint8_t* buffer, uint32_t value)
+        {
+            buffer[0] = static_cast<uint8_t>(value >> 24);
+            buffer[1] = static_cast<uint8_t>(value >> 16);
+            buffer[2] = static_cast<uint8_t>(value >> 8);
+            buffer[3] = static_cast<uint8_t>(value);
+        }
+
+        static uint32_t readUint32(const uint8_t* buffer)
+        {
+            return (static_cast<uint32_t>(buffer[0]) << 24) |
+                (static_cast<uint32_t>(buffer[1]) << 16) |
+                (static_cast<uint32_t>(buffer[2]) << 8) |
+                static_cast<uint32_t>(buffer[3]);
+        }
+
+        Socket socket;
+
+        RequestHandler requestHandler;
+        std::function<void(RpcConnection&)> closeCallback;
+
+        float defaultTimeout = DEFAULT_TIMEOUT;
+        size_t maxFrameSize = DEFAULT_MAX_FRAME_SIZE;
+
+        uint32_t nextId = 1;
+        std::map<uint32_t, PendingRequest> pendingRequests;
+
+        std::vector<uint8_t> inData;
+        size_t inOffset = 0;
+        std::vector<uint8_t> framePayload;
+
+        std::error_code error;
+
+        // set while frames are dispatched, so that the dispatch stops when a callback destroys this object
+        bool* destroyed = nullptr;
+    };
+}
+
+#endif // CPPSOCKET_RPC_HPP
@@ -5,11 +5,18 @@
 #ifndef CPPSOCKET_HPP
 #define CPPSOCKET_HPP
 
+#include <cmath>
+#include <cstddef>
 #include <cstdint>
 #include <cstring>
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <deque>
 #include <functional>
+#include <limits>
+#include <map>
+#include <memory>
 #include <set>
 #include <stdexcept>
 #include <string>
@@ -35,6 +42,11 @@
 #  include <poll.h>
 #  include <unistd.h>
 #endif
+#ifdef __linux__
+#  include <netinet/tcp.h>
+#  include <linux/errqueue.h>
+#  include <linux/net_tstamp.h>
+#endif
 #include <errno.h>
 #include <fcntl.h>
 
@@ -42,6 +54,7 @@ namespace cppsocket
 {
 #ifdef _WIN32
     using socket_t = SOCKET;
+    using ssize_t = int;
     static constexpr socket_t NULL_SOCKET = INVALID_SOCKET;
 #else
     using socket_t = int;
@@ -51,6 +64,16 @@ namespace cppsocket
     static constexpr uint32_t ANY_ADDRESS = 0;
     static constexpr uint16_t ANY_PORT = 0;
     static constexpr int WAITING_QUEUE_SIZE = 5;
+    static constexpr float DEFAULT_CONNECT_TIMEOUT = 10.0f;
+    static constexpr size_t RECEIVE_BUFFER_SIZE = 65536;
+    static constexpr size_t DEFAULT_SEND_BURST = 65536;
+    static constexpr size_t PACING_CHUNK_SIZE = 4096;
+    static constexpr size_t DEFAULT_READ_BUDGET = 4 * RECEIVE_BUFFER_SIZE;
+    static constexpr size_t DEFAULT_READ_EVENT_BUDGET = 16;
+    static constexpr float CONNECTION_ATTEMPT_DELAY = 0.25f;
+    static constexpr float ZERO_COPY_LINGER_TIME = 10.0f;
+
+    using TimerId = uint64_t;
 
     inline std::string ipToString(uint32_t ip)
     {
@@ -119,6 +142,225 @@ namespace cppsocket
 #endif
     }
 
+    inline void setSocketBlocking(socket_t socketFd, bool block)
+    {
+#ifdef _WIN32
+        unsigned long mode = block ? 0 : 1;
+        if (ioctlsocket(socketFd, FIONBIO, &mode) != 0)
+            throw std::system_error(WSAGetLastError(), std::system_category(), "Failed to set socket mode");
+#else
+        int flags = fcntl(socketFd, F_GETFL, 0);
+        if (flags < 0)
+            throw std::system_error(errno, std::system_category(), "Failed to get socket flags");
+        flags = block ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK);
+
+        if (fcntl(socketFd, F_SETFL, flags) != 0)
+            throw std::system_error(errno, std::system_category(), "Failed to set socket flags");
+#endif
+    }
+
+    // the socket calls used by Socket and Network, they behave like their BSD counterparts and report errors through
+    // getLastError, a Network can use another transport than the system one, e.g. MemoryTransport for tests
+    class Transport
+    {
+    public:
+        virtual ~Transport() = default;
+
+        virtual socket_t socket(int domain, int type, int protocol) = 0;
+        virtual int close(socket_t fd) = 0;
+        virtual int bind(socket_t fd, const sockaddr* address, socklen_t addressLength) = 0;
+        virtual int listen(socket_t fd, int backlog) = 0;
+        virtual socket_t accept(socket_t fd, sockaddr* address, socklen_t* addressLength) = 0;
+        virtual int connect(socket_t fd, const sockaddr* address, socklen_t addressLength) = 0;
+        virtual ssize_t send(socket_t fd, const void* data, size_t size, int flags) = 0;
+        virtual ssize_t recv(socket_t fd, void* data, size_t size, int flags) = 0;
+        virtual int poll(pollfd* fds, size_t count, int timeout) = 0;
+        virtual int getsockname(socket_t fd, sockaddr* address, socklen_t* addressLength) = 0;
+        virtual int getpeername(socket_t fd, sockaddr* address, socklen_t* addressLength) = 0;
+        virtual int setsockopt(socket_t fd, int level, int name, const void* value, socklen_t valueLength) = 0;
+        virtual int getsockopt(socket_t fd, int level, int name, void* value, socklen_t* valueLength) = 0;
+
+        // throw std::system_error on failure
+        virtual void setBlocking(socket_t fd, bool block) = 0;
+        virtual bool isBlocking(socket_t fd) = 0;
+
+        // a waker is a descriptor that poll reports as readable once wake has been called on it, Network uses one to
+        // interrupt a blocking update, wake can be called from any thread, the others only from the thread that polls,
+        // createWaker throws std::system_error on failure
+        virtual socket_t createWaker() = 0;
+        virtual void closeWaker(socket_t fd) = 0;
+        virtual void wake(socket_t fd) = 0;
+        virtual void drainWaker(socket_t fd) = 0;
+    };
+
+    // forwards to the socket API of the operating system, the Linux specific features (zero-copy completions and
+    // kernel timestamps) read the error queue of the descriptors directly and only work with this transport
+    class SystemTransport final: public Transport
+    {
+    public:
+        socket_t socket(int domain, int type, int protocol) override
+        {
+            return ::socket(domain, type, protocol);
+        }
+
+        int close(socket_t fd) override
+        {
+#ifdef _WIN32
+            return ::closesocket(fd);
+#else
+            return ::close(fd);
+#endif
+        }
+
+        int bind(socket_t fd, const sockaddr* address, socklen_t addressLength) override
+        {
+            return ::bind(fd, address, addressLength);
+        }
+
+        int listen(socket_t fd, int backlog) override
+        {
+            return ::listen(fd, backlog);
+        }
+
+        socket_t accept(socket_t fd, sockaddr* address, socklen_t* addressLength) override
+        {
+            return ::accept(fd, address, addressLength);
+        }
+
+        int connect(socket_t fd, const sockaddr* address, socklen_t addressLength) override
+        {
+            return ::connect(fd, address, addressLength);
+        }
+
+        ssize_t send(socket_t fd, const void* data, size_t size, int flags) override
+        {
+#ifdef _WIN32
+            return ::send(fd, static_cast<const char*>(data), static_cast<int>(size), flags);
+#else
+            return ::send(fd, data, size, flags);
+#endif
+        }
+
+        ssize_t recv(socket_t fd, void* data, size_t size, int flags) override
+        {
+#ifdef _WIN32
+            return ::recv(fd, static_cast<char*>(data), static_cast<int>(size), flags);
+#else
+            return ::recv(fd, data, size, flags);
+#endif
+        }
+
+        int poll(pollfd* fds, size_t count, int timeout) override
+        {
+#ifdef _WIN32
+            return WSAPoll(fds, static_cast<ULONG>(count), timeout);
+#else
+            return ::poll(fds, static_cast<nfds_t>(count), timeout);
+#endif
+        }
+
+        int getsockname(socket_t fd, sockaddr* address, socklen_t* addressLength) override
+        {
+            return ::getsockname(fd, address, addressLength);
+        }
+
+        int getpeername(socket_t fd, sockaddr* address, socklen_t* addressLength) override
+        {
+            return ::getpeername(fd, address, addressLength);
+        }
+
+        int setsockopt(socket_t fd, int level, int name, const void* value, socklen_t valueLength) override
+        {
+            return ::setsockopt(fd, level, name, static_cast<const char*>(value), valueLength);
+        }
+
+        int getsockopt(socket_t fd, int level, int name, void* value, socklen_t* valueLength) override
+        {
+            return ::getsockopt(fd, level, name, static_cast<char*>(value), valueLength);
+        }
+
+        void setBlocking(socket_t fd, bool block) override
+        {
+            setSocketBlocking(fd, block);
+        }
+
+        bool isBlocking(socket_t fd) override
+        {
+#ifdef _WIN32
+            // the mode of a socket can not be queried on Windows
+            (void)fd;
+            return true;
+#else
+            int flags = fcntl(fd, F_GETFL, 0);
+            if (flags < 0)
+                throw std::system_error(errno, std::system_category(), "Failed to get socket flags");
+            return (flags & O_NONBLOCK) == 0;
+#endif
+        }
+
+        // a UDP socket connected to itself works with poll on every platform
+        socket_t createWaker() override
+        {
+            socket_t fd = ::socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+            if (fd == NULL_SOCKET)
+                throw std::system_error(getLastError(), std::system_category(), "Failed to create wake socket");
+
+            sockaddr_in address;
+            memset(&address, 0, sizeof(address));
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            address.sin_port = 0;
+
+            socklen_t addressLength = sizeof(address);
+
+            if (::bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 ||
+                ::getsockname(fd, reinterpret_cast<sockaddr*>(&address), &addressLength) < 0 ||
+                ::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0)
+            {
+                int error = getLastError();
+                close(fd);
+                throw std::system_error(error, std::system_category(), "Failed to set up wake socket");
+            }
+
+            try
+            {
+                setSocketBlocking(fd, false);
+            }
+            catch (...)
+            {
+                close(fd);
+                throw;
+            }
+
+            return fd;
+        }
+
+        void closeWaker(socket_t fd) override
+        {
+            close(fd);
+        }
+
+        void wake(socket_t fd) override
+        {
+            const uint8_t byte = 0;
+            send(fd, &byte, sizeof(byte), 0);
+        }
+
+        void drainWaker(socket_t fd) override
+        {
+            uint8_t buffer[64];
+
+            while (recv(fd, buffer, sizeof(buffer), 0) > 0);
+        }
+    };
+
+    inline Transport& getSystemTransport()
+    {
+        static SystemTransport transport;
+        return transport;
+    }
+
     inline std::pair<uint32_t, uint16_t> getAddress(const std::string& address)
     {
         std::pair<uint32_t, uint16_t> result(ANY_ADDRESS, ANY_PORT);
@@ -150,13 +392,187 @@ namespace cppsocket
         return result;
     }
 
+    // resolves all IPv4 addresses of the host in the order returned by the resolver, without duplicates
+    inline std::vector<std::pair<uint32_t, uint16_t>> getAddresses(const std::string& address)
+    {
+        std::vector<std::pair<uint32_t, uint16_t>> result;
+
+        size_t i = address.find(':');
+        std::string addressStr;
+        std::string portStr;
+
+        if (i != std::string::npos)
+        {
+            addressStr = address.substr(0, i);
+            portStr = address.substr(i + 1);
+        }
+        else
+            addressStr = address;
+
+        addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+
+        addrinfo* info;
+        int ret = getaddrinfo(addressStr.c_str(), portStr.empty() ? nullptr : portStr.c_str(), &hints, &info);
+
+        if (ret != 0)
+            throw std::system_error(getLastError(), std::system_category(), "Failed to get address info of " + address);
+
+        for (addrinfo* current = info; current; current = current->ai_next)
+        {
+            sockaddr_in* addr = reinterpret_cast<sockaddr_in*>(current->ai_addr);
+            std::pair<uint32_t, uint16_t> entry(addr->sin_addr.s_addr, ntohs(addr->sin_port));
+
+            if (std::find(result.begin(), result.end(), entry) == result.end())
+                result.push_back(entry);
+        }
+
+        freeaddrinfo(info);
+
+        return result;
+    }
+
+    // token bucket of bytesPerSecond with room for burstSize bytes, a rate of 0 is unlimited
+    class RateLimiter final
+    {
+    public:
+        explicit RateLimiter(uint64_t aRate = 0, size_t aBurst = DEFAULT_SEND_BURST):
+            rate(static_cast<double>(aRate)), burst(static_cast<double>(aBurst)), tokens(burst)
+        {
+            lastTime = std::chrono::steady_clock::now();
+        }
+
+        uint64_t getRate() const { return static_cast<uint64_t>(rate); }
+        size_t getBurst() const { return static_cast<size_t>(burst); }
+
+        void setRate(uint64_t newRate, size_t newBurst = DEFAULT_SEND_BURST)
+        {
+            refill();
+            rate = static_cast<double>(newRate);
+            burst = static_cast<double>(newBurst);
+            tokens = std::min(tokens, burst);
+        }
+
+        bool isLimited() const { return rate > 0.0; }
+
+        // number of bytes that can be sent now
+        size_t getAvailable()
+        {
+            if (!isLimited()) return std::numeric_limits<size_t>::max();
+
+            refill();
+            return (tokens > 0.0) ? static_cast<size_t>(tokens) : 0;
+        }
+
+        void consume(size_t size)
+        {
+            if (isLimited()) tokens -= static_cast<double>(size);
+        }
+
+        // seconds until size bytes (at most a full burst) can be sent
+        float getDelay(size_t size) const
+        {
+            if (!isLimited()) return 0.0f;
+
+            double needed = std::min(static_cast<double>(size), burst) - tokens;
+            return (needed > 0.0) ? static_cast<float>(needed / rate) : 0.0f;
+        }
+
+    private:
+        void refill()
+        {
+            auto currentTime = std::chrono::steady_clock::now();
+            double elapsed = std::chrono::duration<double>(currentTime - lastTime).count();
+            lastTime = currentTime;
+
+            tokens = std::min(burst, tokens + elapsed * rate);
+        }
+
+        double rate;
+        double burst;
+        double tokens;
+        std::chrono::steady_clock::time_point lastTime;
+    };
+
+    // sockets of a higher priority class are served before the others in each Network::update
+    enum class Priority: uint8_t
+    {
+        HIGH,
+        NORMAL,
+        LOW
+    };
+
+    // kernel software timestamp of sent data, reported from the error queue of the socket
+    struct SendTimestamp
+    {
+        enum class Type
+        {
+            SENT, // handed to the network device
+            ACKED // acknowledged by the peer
+        };
+
+        Type type = Type::SENT;
+        uint32_t byteOffset = 0; // offset of the last byte of the timestamped send in the stream
+        std::chrono::system_clock::time_point time;
+    };
+
+    // snapshot of the kernel TCP state of a connection
+    struct TcpInfo
+    {
+        float rtt = 0.0f; // smoothed round-trip time in seconds
+        float rttVariance = 0.0f;
+        uint32_t congestionWindow = 0; // in segments
+        uint32_t retransmits = 0; // total number of retransmitted segments
+        uint32_t unackedSegments = 0; // segments sent but not yet acknowledged
+        uint64_t unackedBytes = 0; // unackedSegments estimated in bytes with the send MSS
+    };
+
     class Network;
+    class Socket;
+    class HandoffChannel;
+
+    // no-op base for handlers passed to Network::update, a derived handler hides the events it is interested in,
+    // onError returns true if the error has been handled, otherwise it is thrown as std::system_error
+    class SocketHandler
+    {
+    public:
+        void onRead(Socket&, const std::vector<uint8_t>&) {}
+        void onClose(Socket&) {}
+        void onAccept(Socket&, Socket&) {}
+        void onConnect(Socket&) {}
+        void onConnectError(Socket&) {}
+        void onDrain(Socket&) {}
+        void onSendTimestamp(Socket&, const SendTimestamp&) {}
+        bool onError(Socket&, const std::error_code&) { return false; }
+    };
+
+    // dispatches the events to the std::function callbacks of the socket
+    class CallbackHandler final
+    {
+    public:
+        void onRead(Socket& socket, const std::vector<uint8_t>& data);
+        void onClose(Socket& socket);
+        void onAccept(Socket& socket, Socket& client);
+        void onConnect(Socket& socket);
+        void onConnectError(Socket& socket);
+        void onDrain(Socket& socket);
+        void onSendTimestamp(Socket& socket, const SendTimestamp& timestamp);
+        bool onError(Socket& socket, const std::error_code& error);
+    };
 
     class Socket final
     {
         friend Network;
+        friend CallbackHandler;
+        friend HandoffChannel;
     public:
         Socket(Network& aNetwork);
+
+        // adopts an open socket (e.g. one inherited from another process) without binding, listening or connecting it again,
+        // the socket owns the descriptor once the constructor succeeds
+        Socket(Network& aNetwork, socket_t aSocketFd);
         ~Socket();
 
         Socket(const Socket&) = delete;
@@ -167,39 +583,43 @@ namespace cppsocket
         {
             if (&other != this)
             {
+                stopPacing();
+                stopTcpInfoSampler();
+                stopConnectAttempts();
                 closeSocketFd();
 
                 socketFd = other.socketFd;
                 ready = other.ready;
+                connecting = other.connecting;
+                accepting = other.accepting;
+                zeroCopyPending = other.zeroCopyPending;
+                paced = other.paced;
                 blocking = other.blocking;
+                setPriority(other.priority);
+                outData = std::move(other.outData);
                 localAddress = other.localAddress;
-                localPort = other.localPort;
                 remoteAddress = other.remoteAddress;
+                localPort = other.localPort;
                 remotePort = other.remotePort;
-                connectTimeout = other.connectTimeout;
-                timeSinceConnect = other.timeSinceConnect;
-                accepting = other.accepting;
-                connecting = other.connecting;
-                readCallback = std::move(other.readCallback);
-                closeCallback = std::move(other.closeCallback);
-                acceptCallback = std::move(other.acceptCallback);
-                connectCallback = std::move(other.connectCallback);
-                connectErrorCallback = std::move(other.connectErrorCallback);
-                outData = std::move(other.outData);
+                cold = std::move(other.cold);
 
-                remoteAddressString = ipToString(remoteAddress) + ":" + std::to_string(remotePort);
+                // the timers refer to the other socket, this one polls for writing and paces again
+                stopPacing();
+                restartTcpInfoSampler();
+                restartConnectAttemptTimer();
 
                 other.socketFd = NULL_SOCKET;
                 other.ready = false;
+                other.connecting = false;
+                other.accepting = false;
+                other.zeroCopyPending = false;
+                other.paced = false;
                 other.blocking = true;
+                other.priority = Priority::NORMAL;
                 other.localAddress = 0;
-                other.localPort = 0;
                 other.remoteAddress = 0;
+                other.localPort = 0;
                 other.remotePort = 0;
-                other.accepting = false;
-                other.connecting = false;
-                other.connectTimeout = 10.0f;
-                other.timeSinceConnect = 0.0f;
             }
 
             return *this;
@@ -207,13 +627,16 @@ namespace cppsocket
 
         void close()
         {
+            stopConnectAttempts();
+
             if (socketFd != NULL_SOCKET)
             {
                 if (ready)
                 {
                     try
                     {
-                        writeData();
+                        CallbackHandler handler;
+                        writeData(handler);
                     }
                     catch (...)
                     {
@@ -230,24 +653,30 @@ namespace cppsocket
             ready = false;
             accepting = false;
             connecting = false;
-            outData.clear();
-            inData.clear();
+            clearOutData();
         }
 
         void update(float delta)
+        {
+            CallbackHandler handler;
+            update(delta, handler);
+        }
+
+        template <class Handler>
+        void update(float delta, Handler& handler)
         {
             if (connecting)
             {
-                timeSinceConnect += delta;
+                Cold& data = getCold();
+                data.timeSinceConnect += delta;
 
-                if (timeSinceConnect > connectTimeout)
+                if (data.timeSinceConnect > data.connectTimeout)
                 {
                     connecting = false;
 
                     close();
 
-                    if (connectErrorCallback)
-                        connectErrorCallback(*this);
+                    handler.onConnectError(*this);
                 }
             }
         }
@@ -282,7 +711,7 @@ namespace cppsocket
             localPort = port;
             int value = 1;
 
-            if (setsockopt(socketFd, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&value), sizeof(value)) < 0)
+            if (getTransport().setsockopt(socketFd, SOL_SOCKET, SO_REUSEADDR, &value, sizeof(value)) < 0)
                 throw std::system_error(getLastError(), std::system_category(), "setsockopt(SO_REUSEADDR) failed");
 
             sockaddr_in serverAddress;
@@ -291,10 +720,10 @@ namespace cppsocket
             serverAddress.sin_port = htons(localPort);
             serverAddress.sin_addr.s_addr = address;
 
-            if (bind(socketFd, reinterpret_cast<sockaddr*>(&serverAddress), sizeof(serverAddress)) < 0)
+            if (getTransport().bind(socketFd, reinterpret_cast<sockaddr*>(&serverAddress), sizeof(serverAddress)) < 0)
                 throw std::system_error(getLastError(), std::system_category(), "Failed to bind server socket to port " + std::to_string(localPort));
 
-            if (listen(socketFd, WAITING_QUEUE_SIZE) < 0)
+            if (getTransport().listen(socketFd, WAITING_QUEUE_SIZE) < 0)
                 throw std::system_error(getLastError(), std::system_category(), "Failed to listen on " + ipToString(localAddress) + ":" + std::to_string(localPort));
 
             accepting = true;
@@ -318,13 +747,14 @@ namespace cppsocket
 
             if (socketFd != NULL_SOCKET)
                 close();
+            else
+                stopConnectAttempts();
 
             createSocketFd();
 
             remoteAddress = address;
             remotePort = newPort;
-
-            remoteAddressString = ipToString(remoteAddress) + ":" + std::to_string(remotePort);
+            getCold().timeSinceConnect = 0.0f;
 
             sockaddr_in addr;
             memset(&addr, 0, sizeof(addr));
@@ -332,7 +762,7 @@ namespace cppsocket
             addr.sin_addr.s_addr = remoteAddress;
             addr.sin_port = htons(remotePort);
 
-            if (::connect(socketFd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) < 0)
+            if (getTransport().connect(socketFd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) < 0)
             {
                 int error = getLastError();
 
@@ -345,10 +775,12 @@ namespace cppsocket
                     error != EINPROGRESS)
 #endif
                 {
-                    if (connectErrorCallback)
-                        connectErrorCallback(*this);
+                    std::string message = "Failed to connect to " + getRemoteAddressString();
 
-                    throw std::system_error(error, std::system_category(), "Failed to connect to " + remoteAddressString);
+                    CallbackHandler handler;
+                    handler.onConnectError(*this);
+
+                    throw std::system_error(error, std::system_category(), message);
                 }
 
                 connecting = true;
@@ -357,115 +789,283 @@ namespace cppsocket
             {
                 // connected
                 ready = true;
-                if (connectCallback)
-                    connectCallback(*this);
+
+                if (cold && cold->timestamping)
+                    setFdTimestamping();
+
+                CallbackHandler handler;
+                handler.onConnect(*this);
             }
 
             sockaddr_in localAddr;
             socklen_t localAddrSize = sizeof(localAddr);
 
-            if (getsockname(socketFd, reinterpret_cast<sockaddr*>(&localAddr), &localAddrSize) != 0)
+            if (getTransport().getsockname(socketFd, reinterpret_cast<sockaddr*>(&localAddr), &localAddrSize) != 0)
             {
                 int error = getLastError();
+                std::string message = "Failed to get address of the socket connecting to " + getRemoteAddressString();
                 closeSocketFd();
                 connecting = false;
-                if (connectErrorCallback)
-                    connectErrorCallback(*this);
-                throw std::system_error(error, std::system_category(), "Failed to get address of the socket connecting to " + remoteAddressString);
+                CallbackHandler handler;
+                handler.onConnectError(*this);
+                throw std::system_error(error, std::system_category(), message);
             }
 
             localAddress = localAddr.sin_addr.s_addr;
             localPort = ntohs(localAddr.sin_port);
         }
 
+        // resolves all addresses of the host and races connections to them (RFC 8305 for IPv4), a new attempt starts
+        // every attemptDelay seconds or as soon as all running attempts have failed, the first connection is kept and
+        // the other attempts are closed, the connect error callback is called once all of them have failed or timed out
+        void connectParallel(const std::string& address, float attemptDelay = CONNECTION_ATTEMPT_DELAY)
+        {
+            connectParallel(getAddresses(address), attemptDelay);
+        }
+
+        void connectParallel(const std::vector<std::pair<uint32_t, uint16_t>>& addresses,
+                             float attemptDelay = CONNECTION_ATTEMPT_DELAY);
+
         bool isConnecting() const { return connecting; }
 
-        float getConnectTimeout() const { return connectTimeout; }
-        void setConnectTimeout(float timeout) { connectTimeout = timeout; }
+        float getConnectTimeout() const { return cold ? cold->connectTimeout : DEFAULT_CONNECT_TIMEOUT; }
+        void setConnectTimeout(float timeout) { getCold().connectTimeout = timeout; }
 
         void setReadCallback(const std::function<void(Socket&, const std::vector<uint8_t>&)>& newReadCallback)
         {
-            readCallback = newReadCallback;
+            getCold().readCallback = newReadCallback;
         }
 
         void setCloseCallback(const std::function<void(Socket&)>& newCloseCallback)
         {
-            closeCallback = newCloseCallback;
+            getCold().closeCallback = newCloseCallback;
         }
 
         void setAcceptCallback(const std::function<void(Socket&, Socket&)>& newAcceptCallback)
         {
-            acceptCallback = newAcceptCallback;
+            getCold().acceptCallback = newAcceptCallback;
         }
 
         void setConnectCallback(const std::function<void(Socket&)>& newConnectCallback)
         {
-            connectCallback = newConnectCallback;
+            getCold().connectCallback = newConnectCallback;
         }
 
         void setConnectErrorCallback(const std::function<void(Socket&)>& newConnectErrorCallback)
         {
-            connectErrorCallback = newConnectErrorCallback;
+            getCold().connectErrorCallback = newConnectErrorCallback;
         }
 
-        void send(std::vector<uint8_t> buffer)
+        // once set, I/O errors of the socket are reported to the callback instead of being thrown,
+        // read and write errors are followed by the close or connect error callback, which may destroy the socket
+        void setErrorCallback(const std::function<void(Socket&, const std::error_code&)>& newErrorCallback)
         {
-            if (socketFd == NULL_SOCKET)
-                throw std::runtime_error("Invalid socket");
-
-            outData.insert(outData.end(), buffer.begin(), buffer.end());
+            getCold().errorCallback = newErrorCallback;
         }
 
-        uint32_t getLocalAddress() const { return localAddress; }
-        uint16_t getLocalPort() const { return localPort; }
+        // called after all queued data has been written to the socket
+        void setDrainCallback(const std::function<void(Socket&)>& newDrainCallback)
+        {
+            getCold().drainCallback = newDrainCallback;
+        }
 
-        uint32_t getRemoteAddress() const { return remoteAddress; }
-        uint16_t getRemotePort() const { return remotePort; }
+        bool isTimestamping() const { return cold && cold->timestamping; }
 
-        bool isBlocking() const { return blocking; }
-        void setBlocking(bool newBlocking)
+        // enables kernel software timestamps with SO_TIMESTAMPING (only on Linux), the receive timestamp of the
+        // data passed to the read callback is returned by getReceiveTimestamp and send timestamps are reported
+        // to the send timestamp callback
+        void setTimestamping(bool newTimestamping)
         {
-            blocking = newBlocking;
+            getCold().timestamping = newTimestamping;
 
             if (socketFd != NULL_SOCKET)
-                setFdBlocking(newBlocking);
+                setFdTimestamping();
         }
 
-        bool isReady() const { return ready; }
-        bool hasOutData() const { return !outData.empty(); }
+        // time the kernel received the data of the current read callback, e.g. system_clock::now() minus the timestamp
+        // is the time the data has been waiting in the socket and the event loop, zero if no timestamp is available
+        std::chrono::system_clock::time_point getReceiveTimestamp() const
+        {
+            return cold ? cold->receiveTimestamp : std::chrono::system_clock::time_point();
+        }
 
-    private:
-        Socket(Network& aNetwork, socket_t aSocketFd, bool aReady,
-               uint32_t aLocalAddress, uint16_t aLocalPort,
-               uint32_t aRemoteAddress, uint16_t aRemotePort);
+        void setSendTimestampCallback(const std::function<void(Socket&, const SendTimestamp&)>& newSendTimestampCallback)
+        {
+            getCold().sendTimestampCallback = newSendTimestampCallback;
+        }
 
-        void read()
+        // reads TCP_INFO of a connected socket, returns false if it is not available (only supported on Linux)
+        bool getTcpInfo(TcpInfo& info) const
         {
-            if (accepting)
-            {
-                sockaddr_in address;
-#ifdef _WIN32
-                int addressLength = static_cast<int>(sizeof(address));
-#else
-                socklen_t addressLength = sizeof(address);
-#endif
+#if defined(__linux__) && defined(TCP_INFO)
+            if (socketFd == NULL_SOCKET || !ready || accepting)
+                return false;
 
-                socket_t clientFd = ::accept(socketFd, reinterpret_cast<sockaddr*>(&address), &addressLength);
+            tcp_info data;
+            socklen_t dataLength = sizeof(data);
+            memset(&data, 0, sizeof(data));
 
-                if (clientFd == NULL_SOCKET)
-                {
-                    int error = getLastError();
+            if (getTransport().getsockopt(socketFd, IPPROTO_TCP, TCP_INFO, &data, &dataLength) != 0)
+                return false;
 
-#ifdef _WIN32
-                    if (error != WSAEWOULDBLOCK &&
-                        error != WSAEINPROGRESS)
+            info.rtt = static_cast<float>(data.tcpi_rtt) / 1000000.0f;
+            info.rttVariance = static_cast<float>(data.tcpi_rttvar) / 1000000.0f;
+            info.congestionWindow = data.tcpi_snd_cwnd;
+            info.retransmits = data.tcpi_total_retrans;
+            info.unackedSegments = data.tcpi_unacked;
+            info.unackedBytes = static_cast<uint64_t>(data.tcpi_unacked) * data.tcpi_snd_mss;
+
+            return true;
 #else
-                    if (error != EAGAIN &&
-                        error != EWOULDBLOCK &&
-                        error != EINPROGRESS)
+            (void)info;
+            return false;
 #endif
-                        throw std::system_error(error, std::system_category(), "Failed to accept client");
-                }
+        }
+
+        // calls the callback with the TCP_INFO of the socket every interval seconds while it is connected,
+        // an interval of 0 stops the sampling
+        void setTcpInfoSampler(float interval, const std::function<void(Socket&, const TcpInfo&)>& callback)
+        {
+            stopTcpInfoSampler();
+
+            Cold& data = getCold();
+            data.tcpInfoInterval = interval;
+            data.tcpInfoCallback = callback;
+
+            if (interval > 0.0f && callback)
+                startTcpInfoSampler();
+        }
+
+        void send(std::vector<uint8_t> buffer)
+        {
+            if (socketFd == NULL_SOCKET)
+                throw std::runtime_error("Invalid socket");
+
+            outData.insert(outData.end(), buffer.begin(), buffer.end());
+        }
+
+        size_t getZeroCopyThreshold() const { return cold ? cold->zeroCopyThreshold : 0; }
+
+        // writes of at least newThreshold bytes are sent with MSG_ZEROCOPY and kept alive until the kernel reports their completion, 0 disables it, other platforms than Linux always copy
+        void setZeroCopyThreshold(size_t newThreshold)
+        {
+            getCold().zeroCopyThreshold = newThreshold;
+
+            if (socketFd != NULL_SOCKET && newThreshold)
+                setFdZeroCopy();
+        }
+
+        uint64_t getSendRate() const { return cold ? cold->sendLimiter.getRate() : 0; }
+
+        // limits the data sent by the socket to bytesPerSecond with bursts of up to burstSize bytes, 0 removes the limit,
+        // on Linux the rate is also passed to the kernel with SO_MAX_PACING_RATE, which spaces out the packets with the fq qdisc
+        void setSendRate(uint64_t bytesPerSecond, size_t burstSize = DEFAULT_SEND_BURST)
+        {
+            getCold().sendLimiter.setRate(bytesPerSecond, burstSize);
+
+            if (socketFd != NULL_SOCKET)
+                setFdPacingRate();
+        }
+
+        std::shared_ptr<RateLimiter> getSendGroup() const { return cold ? cold->sendGroup : nullptr; }
+
+        // limits the combined send rate of all sockets sharing the group, the sockets have to belong to the same network
+        void setSendGroup(const std::shared_ptr<RateLimiter>& newSendGroup)
+        {
+            getCold().sendGroup = newSendGroup;
+        }
+
+        Priority getPriority() const { return priority; }
+        void setPriority(Priority newPriority);
+
+        size_t getReadBudget() const { return cold ? cold->readBudget : DEFAULT_READ_BUDGET; }
+        size_t getReadEventBudget() const { return cold ? cold->readEventBudget : DEFAULT_READ_EVENT_BUDGET; }
+
+        // a non-blocking socket keeps reading in an update until it would block or has received bytes or
+        // accepted events clients, the rest is left for the next update, so that a busy peer does not starve the others
+        void setReadBudget(size_t bytes, size_t events = DEFAULT_READ_EVENT_BUDGET)
+        {
+            Cold& data = getCold();
+            data.readBudget = bytes;
+            data.readEventBudget = events;
+        }
+
+        // thread-safe variants of send, close and connect, executed by the Network at the start of its next update,
+        // postConnect resolves the address on the calling thread, connect errors are reported to the connect error and error callbacks
+        void postSend(std::vector<uint8_t> buffer);
+        void postClose();
+        void postConnect(const std::string& address);
+        void postConnect(uint32_t address, uint16_t newPort);
+
+        uint32_t getLocalAddress() const { return localAddress; }
+        uint16_t getLocalPort() const { return localPort; }
+
+        uint32_t getRemoteAddress() const { return remoteAddress; }
+        uint16_t getRemotePort() const { return remotePort; }
+
+        bool isBlocking() const { return blocking; }
+        void setBlocking(bool newBlocking)
+        {
+            blocking = newBlocking;
+
+            if (socketFd != NULL_SOCKET)
+                setFdBlocking(newBlocking);
+        }
+
+        Network& getNetwork() const { return network; }
+
+        // moves the descriptor, the unsent data and the callbacks to a new socket owned by target, which is
+        // passed to the adopt callback of target on its thread, this socket is left closed and can be destroyed,
+        // has to be called on the thread of the current network, the callbacks are called on the thread of target afterwards,
+        // the send group is removed, because a group can only be shared by the sockets of one network,
+        // sends and closes posted to this socket afterwards are forwarded to the new socket
+        void migrate(Network& target);
+
+        bool isReady() const { return ready; }
+        bool hasOutData() const { return !outData.empty() || zeroCopyPending; }
+
+    private:
+        Socket(Network& aNetwork, socket_t aSocketFd, bool aReady,
+               uint32_t aLocalAddress, uint16_t aLocalPort,
+               uint32_t aRemoteAddress, uint16_t aRemotePort);
+
+        // takes over the state of other without registering with aNetwork, used by migrate
+        Socket(Network& aNetwork, Socket&& other);
+
+        // returns the number of bytes read or 1 for an accepted client, 0 if the socket would block or has been disconnected
+        template <class Handler>
+        size_t read(Handler& handler)
+        {
+            if (accepting)
+            {
+                sockaddr_in address;
+#ifdef _WIN32
+                int addressLength = static_cast<int>(sizeof(address));
+#else
+                socklen_t addressLength = sizeof(address);
+#endif
+
+                socket_t clientFd = getTransport().accept(socketFd, reinterpret_cast<sockaddr*>(&address), &addressLength);
+
+                if (clientFd == NULL_SOCKET)
+                {
+                    int error = getLastError();
+
+#ifdef _WIN32
+                    if (error != WSAEWOULDBLOCK &&
+                        error != WSAEINPROGRESS)
+#else
+                    if (error != EAGAIN &&
+                        error != EWOULDBLOCK &&
+                        error != EINPROGRESS)
+#endif
+                    {
+                        if (!handler.onError(*this, std::error_code(error, std::system_category())))
+                            throw std::system_error(error, std::system_category(), "Failed to accept client");
+                    }
+
+                    return 0;
+                }
                 else
                 {
                     Socket socket(network, clientFd, true,
@@ -473,30 +1073,40 @@ namespace cppsocket
                                   address.sin_addr.s_addr,
                                   ntohs(address.sin_port));
 
-                    if (acceptCallback)
-                        acceptCallback(*this, socket);
+                    handler.onAccept(*this, socket);
+
+                    return 1;
                 }
             }
             else
             {
-                return readData();
+                return readData(handler);
             }
         }
 
-        void write()
+        template <class Handler>
+        void write(Handler& handler)
         {
             if (connecting)
             {
                 connecting = false;
                 ready = true;
-                if (connectCallback)
-                    connectCallback(*this);
+
+                if (cold && cold->timestamping)
+                    setFdTimestamping();
+
+                handler.onConnect(*this);
             }
 
-            return writeData();
+            if (!hasOutData())
+                return;
+
+            if (writeData(handler) && !hasOutData())
+                handler.onDrain(*this);
         }
 
-        void readData()
+        template <class Handler>
+        size_t readData(Handler& handler)
         {
 #if defined(__APPLE__)
             int flags = 0;
@@ -506,18 +1116,25 @@ namespace cppsocket
             int flags = MSG_NOSIGNAL;
 #endif
 
-#ifdef _WIN32
-            int size = recv(socketFd, reinterpret_cast<char*>(tempBuffer), sizeof(tempBuffer), flags);
-#else
-            ssize_t size = recv(socketFd, reinterpret_cast<char*>(tempBuffer), sizeof(tempBuffer), flags);
+            std::vector<uint8_t>& receiveBuffer = getReceiveBuffer();
+
+            ssize_t size;
+#if defined(__linux__) && defined(SO_TIMESTAMPING)
+            if (cold && cold->timestamping)
+                size = receiveTimestamped(receiveBuffer, flags);
+            else
 #endif
+                size = getTransport().recv(socketFd, receiveBuffer.data(), receiveBuffer.size(), flags);
 
             if (size > 0)
             {
-                inData.assign(tempBuffer, tempBuffer + size);
+                // shared by all sockets of the network, only valid until the read handler returns
+                std::vector<uint8_t>& inData = getInData();
+                inData.assign(receiveBuffer.begin(), receiveBuffer.begin() + size);
 
-                if (readCallback)
-                    readCallback(*this, inData);
+                handler.onRead(*this, inData);
+
+                return static_cast<size_t>(size);
             }
             else if (size < 0)
             {
@@ -532,311 +1149,1386 @@ namespace cppsocket
                     error != EINPROGRESS)
 #endif
                 {
-                    disconnected();
+                    if (handler.onError(*this, std::error_code(error, std::system_category())))
+                    {
+                        disconnected(handler);
+                        return 0;
+                    }
 
+                    // the callbacks in disconnected can destroy the socket
+                    std::string message;
                     if (error == ECONNRESET)
-                        throw std::system_error(error, std::system_category(), "Connection to " + remoteAddressString + " reset by peer");
+                        message = "Connection to " + getRemoteAddressString() + " reset by peer";
                     else if (error == ECONNREFUSED)
-                        throw std::system_error(error, std::system_category(), "Connection to " + remoteAddressString + " refused");
+                        message = "Connection to " + getRemoteAddressString() + " refused";
                     else
-                        throw std::system_error(error, std::system_category(), "Failed to read from " + remoteAddressString);
+                        message = "Failed to read from " + getRemoteAddressString();
+
+                    disconnected(handler);
+
+                    throw std::system_error(error, std::system_category(), message);
                 }
             }
             else // size == 0
-                disconnected();
+                disconnected(handler);
 
+            return 0;
         }
 
-        void writeData()
+        // returns false if the socket has been disconnected, in which case it may have been destroyed by the callbacks
+        template <class Handler>
+        bool writeData(Handler& handler)
         {
-            if (ready && !outData.empty())
+            if (!ready) return false;
+
+            size_t allowance = getSendAllowance();
+
+            if (!allowance) return true;
+
+#if defined(__linux__) && defined(SO_ZEROCOPY)
+            while (zeroCopyPending ||
+                   (cold && cold->zeroCopyThreshold && outData.size() >= cold->zeroCopyThreshold))
             {
-#if defined(__APPLE__)
-                int flags = 0;
-#elif defined(_WIN32)
-                int flags = 0;
-#else
-                int flags = MSG_NOSIGNAL;
-#endif
+                if (!allowance)
+                    return true;
 
-#ifdef _WIN32
-                int dataSize = static_cast<int>(outData.size());
-                int size = ::send(socketFd, reinterpret_cast<const char*>(outData.data()), dataSize, flags);
-#else
-                size_t dataSize = static_cast<size_t>(outData.size());
-                ssize_t size = ::send(socketFd, reinterpret_cast<const char*>(outData.data()), dataSize, flags);
-#endif
+                if (!zeroCopyPending)
+                {
+                    ZeroCopyBuffer buffer;
+                    buffer.data.swap(outData);
+                    cold->zeroCopyBuffers.push_back(std::move(buffer));
+                    zeroCopyPending = true;
+                }
+
+                // the buffer in flight has to be sent completely before the data queued after it
+                ZeroCopyBuffer& buffer = cold->zeroCopyBuffers.back();
+                ssize_t size = sendData(handler, buffer.data.data() + buffer.offset,
+                                        std::min(buffer.data.size() - buffer.offset, allowance),
+                                        MSG_ZEROCOPY);
 
                 if (size < 0)
+                    return false;
+
+                if (size > 0)
                 {
-                    int error = getLastError();
+                    buffer.offset += static_cast<size_t>(size);
+                    buffer.lastSequence = cold->zeroCopySequence++;
+                    consumeSendAllowance(static_cast<size_t>(size), allowance);
+                }
+
+                if (buffer.offset < buffer.data.size())
+                    return true;
+
+                zeroCopyPending = false;
+            }
+#endif
+
+            if (!outData.empty() && allowance)
+            {
 #ifdef _WIN32
-                    if (error != WSAEWOULDBLOCK &&
-                        error != WSAEINPROGRESS)
+                int size = sendData(handler, outData.data(), std::min(outData.size(), allowance), 0);
 #else
-                    if (error != EAGAIN &&
-                        error != EWOULDBLOCK &&
-                        error != EINPROGRESS)
+                ssize_t size = sendData(handler, outData.data(), std::min(outData.size(), allowance), 0);
 #endif
-                    {
-                        disconnected();
-
-                        if (error == EPIPE)
-                            throw std::system_error(error, std::system_category(), "Failed to send data to " + remoteAddressString + ", socket has been shut down");
-                        else if (error == ECONNRESET)
-                            throw std::system_error(error, std::system_category(), "Connection to " + remoteAddressString + " reset by peer");
-                        else
-                            throw std::system_error(error, std::system_category(), "Failed to write to socket " + remoteAddressString);
-                    }
-                }
+
+                if (size < 0)
+                    return false;
 
                 if (size > 0)
+                {
                     outData.erase(outData.begin(), outData.begin() + size);
+                    consumeSendAllowance(static_cast<size_t>(size), allowance);
+                }
             }
+
+            return true;
         }
 
-        void disconnected()
+        struct ConnectAttempt
         {
-            if (connecting)
+            socket_t fd;
+            uint32_t address;
+            uint16_t port;
+        };
+
+        // called by Network when a connection attempt of connectParallel becomes writable or fails
+        template <class Handler>
+        void checkConnectAttempt(Handler& handler, socket_t fd)
+        {
+            std::vector<ConnectAttempt>& attempts = cold->connectAttempts;
+            auto i = std::find_if(attempts.begin(), attempts.end(), [fd](const ConnectAttempt& attempt) {
+                return attempt.fd == fd;
+            });
+
+            if (i == attempts.end())
+                return;
+
+            int error = 0;
+#ifdef _WIN32
+            int errorLength = static_cast<int>(sizeof(error));
+#else
+            socklen_t errorLength = sizeof(error);
+#endif
+
+            if (getTransport().getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &errorLength) != 0)
+                error = getLastError();
+
+            if (error == 0)
             {
-                connecting = false;
-                ready = false;
+                sockaddr_in address;
+#ifdef _WIN32
+                int addressLength = static_cast<int>(sizeof(address));
+#else
+                socklen_t addressLength = sizeof(address);
+#endif
 
-                if (socketFd != NULL_SOCKET)
-                    closeSocketFd();
+                // still connecting
+                if (getTransport().getpeername(fd, reinterpret_cast<sockaddr*>(&address), &addressLength) != 0)
+                    return;
 
-                if (connectErrorCallback)
-                    connectErrorCallback(*this);
+                adoptConnectAttempt(static_cast<size_t>(i - attempts.begin()));
+
+                handler.onConnect(*this);
             }
             else
             {
-                if (ready)
-                {
-                    ready = false;
+                closeSocketFd(i->fd);
+                attempts.erase(i);
 
-                    if (closeCallback)
-                        closeCallback(*this);
+                // the next address is tried right away instead of waiting for the attempt delay
+                int startError = 0;
+                if (startConnectAttempt(startError))
+                    return;
 
-                    if (socketFd != NULL_SOCKET)
-                        closeSocketFd();
-
-                    localAddress = 0;
-                    localPort = 0;
-                    remoteAddress = 0;
-                    remotePort = 0;
-                    ready = false;
-                    outData.clear();
-                }
+                connecting = false;
+                handler.onConnectError(*this);
             }
         }
 
-        void createSocketFd()
+        bool startConnectAttempt(int& error);
+        void adoptConnectAttempt(size_t index);
+        void stopConnectAttempts();
+        void restartConnectAttemptTimer();
+
+        // returns the number of bytes the rate limits allow to send now, if that is less than a pacing chunk,
+        // the socket stops polling for writing until a timer signals that enough tokens are available
+        size_t getSendAllowance()
         {
-            socketFd = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+            if (paced) return 0;
 
-            if (socketFd == NULL_SOCKET)
-                throw std::system_error(getLastError(), std::system_category(), "Failed to create socket");
+            if (!cold || (!cold->sendLimiter.isLimited() && !cold->sendGroup))
+                return std::numeric_limits<size_t>::max();
 
-            if (!blocking)
-                setFdBlocking(false);
+            size_t available = cold->sendLimiter.getAvailable();
+            if (cold->sendGroup)
+                available = std::min(available, cold->sendGroup->getAvailable());
 
-#ifdef __APPLE__
-            int set = 1;
-            if (setsockopt(socketFd, SOL_SOCKET, SO_NOSIGPIPE, &set, sizeof(int)) != 0)
-                throw std::system_error(errno, std::system_category(), "Failed to set socket option");
-#endif
+            size_t pending = outData.size();
+            if (zeroCopyPending)
+                pending += cold->zeroCopyBuffers.back().data.size() - cold->zeroCopyBuffers.back().offset;
+
+            // a burst smaller than a pacing chunk would never have enough tokens for a full chunk, and waiting for
+            // only half a burst leaves room for the tokens that arrive while poll rounds its timeout up to milliseconds
+            size_t wanted = std::min(pending, PACING_CHUNK_SIZE);
+            if (cold->sendLimiter.isLimited())
+                wanted = std::min(wanted, std::max<size_t>(cold->sendLimiter.getBurst() / 2, 1));
+            if (cold->sendGroup && cold->sendGroup->isLimited())
+                wanted = std::min(wanted, std::max<size_t>(cold->sendGroup->getBurst() / 2, 1));
+
+            if (available >= wanted)
+                return available;
+
+            float delay = cold->sendLimiter.getDelay(wanted);
+            if (cold->sendGroup)
+                delay = std::max(delay, cold->sendGroup->getDelay(wanted));
+
+            startPacing(delay);
+
+            return 0;
         }
 
-        void closeSocketFd()
+        void consumeSendAllowance(size_t size, size_t& allowance)
         {
-            if (socketFd != NULL_SOCKET)
+            allowance -= size;
+
+            if (cold)
             {
-#ifdef _WIN32
-                closesocket(socketFd);
-#else
-                ::close(socketFd);
-#endif
-                socketFd = NULL_SOCKET;
+                cold->sendLimiter.consume(size);
+                if (cold->sendGroup) cold->sendGroup->consume(size);
             }
         }
 
-        void setFdBlocking(bool block)
-        {
-            if (socketFd == NULL_SOCKET)
-                throw std::runtime_error("Invalid socket");
+        void startPacing(float delay);
+        void stopPacing();
 
+        void startTcpInfoSampler();
+        void stopTcpInfoSampler();
+        void restartTcpInfoSampler();
+
+        // returns the number of bytes sent, 0 if the socket would block and -1 if it has been disconnected
+        template <class Handler>
 #ifdef _WIN32
-            unsigned long mode = block ? 0 : 1;
-            if (ioctlsocket(socketFd, FIONBIO, &mode) != 0)
-                throw std::system_error(WSAGetLastError(), std::system_category(), "Failed to set socket mode");
+        int sendData(Handler& handler, const uint8_t* data, size_t dataSize, int flags)
 #else
-            int flags = fcntl(socketFd, F_GETFL, 0);
-            if (flags < 0)
-                throw std::system_error(errno, std::system_category(), "Failed to get socket flags");
-            flags = block ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK);
-
-            if (fcntl(socketFd, F_SETFL, flags) != 0)
-                throw std::system_error(errno, std::system_category(), "Failed to set socket flags");
+        ssize_t sendData(Handler& handler, const uint8_t* data, size_t dataSize, int flags)
+#endif
+        {
+#if !defined(__APPLE__) && !defined(_WIN32)
+            flags |= MSG_NOSIGNAL;
 #endif
-        }
-
-        Network& network;
-
-        socket_t socketFd = NULL_SOCKET;
-
-        bool ready = false;
-        bool blocking = true;
-
-        uint32_t localAddress = 0;
-        uint16_t localPort = 0;
 
-        uint32_t remoteAddress = 0;
-        uint16_t remotePort = 0;
+            ssize_t size = getTransport().send(socketFd, data, dataSize, flags);
 
-        float connectTimeout = 10.0f;
-        float timeSinceConnect = 0.0f;
-        bool accepting = false;
-        bool connecting = false;
+            if (size < 0)
+            {
+                int error = getLastError();
+#ifdef _WIN32
+                if (error != WSAEWOULDBLOCK &&
+                    error != WSAEINPROGRESS)
+#else
+                if (error != EAGAIN &&
+                    error != EWOULDBLOCK &&
+                    error != EINPROGRESS)
+#endif
+                {
+                    if (handler.onError(*this, std::error_code(error, std::system_category())))
+                    {
+                        disconnected(handler);
+                        return -1;
+                    }
 
-        std::function<void(Socket&, const std::vector<uint8_t>&)> readCallback;
-        std::function<void(Socket&)> closeCallback;
-        std::function<void(Socket&, Socket&)> acceptCallback;
-        std::function<void(Socket&)> connectCallback;
-        std::function<void(Socket&)> connectErrorCallback;
+                    // the callbacks in disconnected can destroy the socket
+                    std::string message;
+                    if (error == EPIPE)
+                        message = "Failed to send data to " + getRemoteAddressString() + ", socket has been shut down";
+                    else if (error == ECONNRESET)
+                        message = "Connection to " + getRemoteAddressString() + " reset by peer";
+                    else
+                        message = "Failed to write to socket " + getRemoteAddressString();
 
-        std::vector<uint8_t> inData;
-        std::vector<uint8_t> outData;
+                    disconnected(handler);
 
-        std::string remoteAddressString;
+                    throw std::system_error(error, std::system_category(), message);
+                }
 
-        uint8_t tempBuffer[1024];
-    };
+                return 0;
+            }
 
-    class Network final
-    {
-        friend Socket;
-    public:
-        Network()
-        {
-            previousTime = std::chrono::steady_clock::now();
+            return size;
         }
 
-        void update()
+#ifdef __linux__
+        // reads one notification from the error queue, returns false if the queue is empty,
+        // the send timestamp handler is called last, because it can destroy the socket
+        template <class Handler>
+        bool readErrorQueue(Handler& handler)
         {
-            for (Socket* socket : socketDeleteSet)
-            {
-                auto i = std::find(sockets.begin(), sockets.end(), socket);
+            alignas(cmsghdr) uint8_t control[256];
+            msghdr message;
+            memset(&message, 0, sizeof(message));
+            message.msg_control = control;
+            message.msg_controllen = sizeof(control);
 
-                if (i != sockets.end())
-                    sockets.erase(i);
-            }
+            // only notifications are read from the error queue, socket errors are reported by recv and send
+            if (recvmsg(socketFd, &message, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+                return false;
 
-            socketDeleteSet.clear();
+            bool timestamped = false;
+            SendTimestamp timestamp;
 
-            for (Socket* socket : socketAddSet)
+            for (cmsghdr* header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header))
             {
-                auto i = std::find(sockets.begin(), sockets.end(), socket);
-
-                if (i == sockets.end())
-                    sockets.push_back(socket);
-            }
+#ifdef SO_TIMESTAMPING
+                if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_TIMESTAMPING)
+                {
+                    scm_timestamping timestamps;
+                    memcpy(&timestamps, CMSG_DATA(header), sizeof(timestamps));
+                    timestamp.time = toTimePoint(timestamps.ts[0]);
+                }
+#endif
 
-            socketAddSet.clear();
+                if ((header->cmsg_level == SOL_IP && header->cmsg_type == IP_RECVERR) ||
+                    (header->cmsg_level == SOL_IPV6 && header->cmsg_type == IPV6_RECVERR))
+                {
+                    sock_extended_err error;
+                    memcpy(&error, CMSG_DATA(header), sizeof(error));
 
-            auto currentTime = std::chrono::steady_clock::now();
-            auto diff = std::chrono::duration_cast<std::chrono::microseconds>(currentTime - previousTime);
+#ifdef SO_EE_ORIGIN_ZEROCOPY
+                    // ee_info..ee_data is the range of completed sends
+                    if (error.ee_errno == 0 && error.ee_origin == SO_EE_ORIGIN_ZEROCOPY)
+                    {
+                        cold->zeroCopyCompleted = error.ee_data + 1;
+                        releaseZeroCopyBuffers(error.ee_data);
+                    }
+#endif
 
-            float delta = diff.count() / 1000000000.0f;
-            previousTime = currentTime;
+#ifdef SO_TIMESTAMPING
+                    if (error.ee_origin == SO_EE_ORIGIN_TIMESTAMPING &&
+                        (error.ee_info == SCM_TSTAMP_SND || error.ee_info == SCM_TSTAMP_ACK))
+                    {
+                        timestamped = true;
+                        timestamp.type = (error.ee_info == SCM_TSTAMP_ACK) ? SendTimestamp::Type::ACKED : SendTimestamp::Type::SENT;
+                        timestamp.byteOffset = error.ee_data;
+                    }
+#endif
+                }
+            }
+
+            if (timestamped)
+                handler.onSendTimestamp(*this, timestamp);
+
+            return true;
+        }
+
+#ifdef SO_TIMESTAMPING
+        ssize_t receiveTimestamped(std::vector<uint8_t>& receiveBuffer, int flags)
+        {
+            iovec vector;
+            vector.iov_base = receiveBuffer.data();
+            vector.iov_len = receiveBuffer.size();
+
+            alignas(cmsghdr) uint8_t control[CMSG_SPACE(sizeof(scm_timestamping))];
+            msghdr message;
+            memset(&message, 0, sizeof(message));
+            message.msg_iov = &vector;
+            message.msg_iovlen = 1;
+            message.msg_control = control;
+            message.msg_controllen = sizeof(control);
+
+            ssize_t size = recvmsg(socketFd, &message, flags);
+
+            cold->receiveTimestamp = std::chrono::system_clock::time_point();
+
+            if (size > 0)
+            {
+                for (cmsghdr* header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header))
+                {
+                    if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_TIMESTAMPING)
+                    {
+                        scm_timestamping timestamps;
+                        memcpy(&timestamps, CMSG_DATA(header), sizeof(timestamps));
+                        cold->receiveTimestamp = toTimePoint(timestamps.ts[0]);
+                    }
+                }
+            }
+
+            return size;
+        }
+
+        static std::chrono::system_clock::time_point toTimePoint(const timespec& time)
+        {
+            return std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                std::chrono::seconds(time.tv_sec) + std::chrono::nanoseconds(time.tv_nsec)));
+        }
+#endif
+
+        // blocks until the kernel has reported the completion of every zero-copy send or the timeout has passed
+        void waitForZeroCopyCompletions(float timeout)
+        {
+            const auto deadline = std::chrono::steady_clock::now() +
+                std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float>(timeout));
+
+            while (cold && cold->zeroCopyCompleted != cold->zeroCopySequence)
+            {
+                // send timestamps read from the queue in the meantime are not reported
+                SocketHandler handler;
+                while (readErrorQueue(handler));
+
+                if (cold->zeroCopyCompleted == cold->zeroCopySequence)
+                    break;
+
+                const auto timeLeft = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+
+                if (timeLeft.count() <= 0)
+                    break;
+
+                // POLLERR is reported without being requested
+                pollfd pollFd;
+                pollFd.fd = socketFd;
+                pollFd.events = 0;
+                pollFd.revents = 0;
+                ::poll(&pollFd, 1, static_cast<int>(timeLeft.count()) + 1);
+            }
+        }
+
+        void releaseZeroCopyBuffers(uint32_t completedSequence)
+        {
+            std::deque<ZeroCopyBuffer>& zeroCopyBuffers = getCold().zeroCopyBuffers;
+
+            while (!zeroCopyBuffers.empty())
+            {
+                const ZeroCopyBuffer& buffer = zeroCopyBuffers.front();
+
+                if (buffer.offset < buffer.data.size() ||
+                    static_cast<int32_t>(buffer.lastSequence - completedSequence) > 0)
+                    break;
+
+                zeroCopyBuffers.pop_front();
+            }
+        }
+#endif
+
+        template <class Handler>
+        void disconnected(Handler& handler)
+        {
+            if (connecting)
+            {
+                connecting = false;
+                ready = false;
+
+                if (socketFd != NULL_SOCKET)
+                    closeSocketFd();
+
+                handler.onConnectError(*this);
+            }
+            else
+            {
+                if (ready)
+                {
+                    ready = false;
+
+                    if (socketFd != NULL_SOCKET)
+                        closeSocketFd();
+
+                    clearOutData();
+
+                    // called last, because the close handler can destroy the socket
+                    handler.onClose(*this);
+                }
+            }
+        }
+
+        void createSocketFd()
+        {
+            socketFd = getTransport().socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+            if (socketFd == NULL_SOCKET)
+                throw std::system_error(getLastError(), std::system_category(), "Failed to create socket");
+
+            setFdOptions();
+        }
+
+        void setFdOptions()
+        {
+            if (!blocking)
+                setFdBlocking(false);
+
+#ifdef __APPLE__
+            int set = 1;
+            if (getTransport().setsockopt(socketFd, SOL_SOCKET, SO_NOSIGPIPE, &set, sizeof(int)) != 0)
+                throw std::system_error(errno, std::system_category(), "Failed to set socket option");
+#endif
+
+            if (cold && cold->zeroCopyThreshold)
+                setFdZeroCopy();
+
+            if (cold && cold->sendLimiter.isLimited())
+                setFdPacingRate();
+
+            if (cold && cold->timestamping)
+                setFdTimestamping();
+        }
+
+        void setFdTimestamping()
+        {
+#if defined(__linux__) && defined(SO_TIMESTAMPING)
+            // software timestamps only, so that no hardware support is needed,
+            // OPT_ID numbers the send timestamps by byte offset and OPT_TSONLY keeps the data out of the error queue
+            int flags = cold->timestamping ?
+                (SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_TX_ACK |
+                 SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_OPT_TSONLY) : 0;
+
+            // TCP only accepts OPT_ID on a connected socket, so it is set again once the connection is established
+            if (cold->timestamping && ready && !accepting)
+                flags |= SOF_TIMESTAMPING_OPT_ID;
+
+            if (getTransport().setsockopt(socketFd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) != 0)
+                throw std::system_error(errno, std::system_category(), "setsockopt(SO_TIMESTAMPING) failed");
+#endif
+        }
+
+        void setFdZeroCopy()
+        {
+#if defined(__linux__) && defined(SO_ZEROCOPY)
+            int set = 1;
+            if (getTransport().setsockopt(socketFd, SOL_SOCKET, SO_ZEROCOPY, &set, sizeof(set)) != 0)
+                throw std::system_error(errno, std::system_category(), "setsockopt(SO_ZEROCOPY) failed");
+#endif
+        }
+
+        void setFdPacingRate()
+        {
+#if defined(__linux__) && defined(SO_MAX_PACING_RATE)
+            // best effort, without the fq qdisc or TCP internal pacing the option has no effect
+            const uint64_t rate = getSendRate();
+            unsigned int value = (rate == 0 || rate >= std::numeric_limits<unsigned int>::max()) ?
+                std::numeric_limits<unsigned int>::max() : static_cast<unsigned int>(rate);
+            getTransport().setsockopt(socketFd, SOL_SOCKET, SO_MAX_PACING_RATE, &value, sizeof(value));
+#endif
+        }
+
+        void closeSocketFd()
+        {
+            if (socketFd != NULL_SOCKET)
+            {
+#if defined(__linux__) && defined(SO_ZEROCOPY)
+                // the kernel keeps sending from the pinned buffers after the socket is closed
+                if (cold && cold->zeroCopyCompleted != cold->zeroCopySequence)
+                    lingerSocketFd();
+                else
+#endif
+                    closeSocketFd(socketFd);
+
+                socketFd = NULL_SOCKET;
+            }
+        }
+
+        // passes the descriptor and the zero-copy buffers to the network, which frees them once the kernel is done with them
+        void lingerSocketFd();
+
+        void closeSocketFd(socket_t fd)
+        {
+            getTransport().close(fd);
+        }
+
+        void setFdBlocking(bool block)
+        {
+            if (socketFd == NULL_SOCKET)
+                throw std::runtime_error("Invalid socket");
 
-            std::vector<pollfd> pollFds;
-            pollFds.reserve(sockets.size());
+            getTransport().setBlocking(socketFd, block);
+        }
+
+        void clearOutData()
+        {
+            outData.clear();
+            zeroCopyPending = false;
+            stopPacing();
+
+            if (cold)
+            {
+                cold->zeroCopyBuffers.clear();
+                cold->zeroCopySequence = 0;
+                cold->zeroCopyCompleted = 0;
+            }
+        }
+
+        std::string getRemoteAddressString() const
+        {
+            return ipToString(remoteAddress) + ":" + std::to_string(remotePort);
+        }
+
+        Transport& getTransport() const;
+        std::vector<uint8_t>& getReceiveBuffer();
+        std::vector<uint8_t>& getInData();
+
+        struct ZeroCopyBuffer
+        {
+            std::vector<uint8_t> data;
+            size_t offset = 0;
+            uint32_t lastSequence = 0;
+        };
+
+        // rarely used state, allocated on first use and kept out of the fields Network::update touches every tick
+        struct Cold
+        {
+            float connectTimeout = DEFAULT_CONNECT_TIMEOUT;
+            float timeSinceConnect = 0.0f;
+
+            std::function<void(Socket&, const std::vector<uint8_t>&)> readCallback;
+            std::function<void(Socket&)> closeCallback;
+            std::function<void(Socket&, Socket&)> acceptCallback;
+            std::function<void(Socket&)> connectCallback;
+            std::function<void(Socket&)> connectErrorCallback;
+            std::function<void(Socket&)> drainCallback;
+            std::function<void(Socket&, const SendTimestamp&)> sendTimestampCallback;
+            std::function<void(Socket&, const std::error_code&)> errorCallback;
+
+            size_t zeroCopyThreshold = 0;
+            uint32_t zeroCopySequence = 0;
+            uint32_t zeroCopyCompleted = 0; // the sequence of the next completion the kernel will report
+            std::deque<ZeroCopyBuffer> zeroCopyBuffers;
+
+            RateLimiter sendLimiter;
+            std::shared_ptr<RateLimiter> sendGroup;
+            TimerId pacingTimer = 0;
+
+            size_t readBudget = DEFAULT_READ_BUDGET;
+            size_t readEventBudget = DEFAULT_READ_EVENT_BUDGET;
+
+            bool timestamping = false;
+            std::chrono::system_clock::time_point receiveTimestamp;
+
+            float tcpInfoInterval = 0.0f;
+            std::function<void(Socket&, const TcpInfo&)> tcpInfoCallback;
+            TimerId tcpInfoTimer = 0;
+
+            std::vector<ConnectAttempt> connectAttempts;
+            std::deque<std::pair<uint32_t, uint16_t>> pendingAddresses;
+            float attemptDelay = CONNECTION_ATTEMPT_DELAY;
+            TimerId attemptTimer = 0;
+        };
+
+        Cold& getCold()
+        {
+            if (!cold) cold.reset(new Cold());
+            return *cold;
+        }
+
+        socket_t socketFd = NULL_SOCKET;
+        // assigned by the network when the socket is registered, so that commands posted to a destroyed socket
+        // are not executed by another socket allocated at the same address
+        uint32_t socketId = 0;
+
+        bool ready = false;
+        bool connecting = false;
+        bool accepting = false;
+        bool zeroCopyPending = false;
+        bool paced = false;
+        bool blocking = true;
+        Priority priority = Priority::NORMAL;
+
+        std::vector<uint8_t> outData;
+
+        Network& network;
+
+        uint32_t localAddress = 0;
+        uint32_t remoteAddress = 0;
+        uint16_t localPort = 0;
+        uint16_t remotePort = 0;
+
+        std::unique_ptr<Cold> cold;
+    };
+
+    class Network final
+    {
+        friend Socket;
+    public:
+        Network():
+            Network(getSystemTransport())
+        {
+        }
+
+        // the transport has to outlive the network
+        explicit Network(Transport& aTransport):
+            transport(aTransport), receiveBuffer(RECEIVE_BUFFER_SIZE)
+        {
+            previousTime = std::chrono::steady_clock::now();
+
+            commandHead.store(&commandStub);
+            wakeFd = transport.createWaker();
+        }
+
+        ~Network()
+        {
+            while (Command* command = popCommand())
+                delete command;
+
+            // the kernel can still be sending from these buffers, but the network can not wait for it any longer
+            for (const LingeringSocket& lingeringSocket : lingeringSockets)
+                transport.close(lingeringSocket.fd);
+
+            transport.closeWaker(wakeFd);
+        }
+
+        Network(const Network&) = delete;
+        Network& operator=(const Network&) = delete;
+
+        // waitTime is the maximum number of seconds to block in poll, a negative value blocks until an event arrives
+        void update(float waitTime = 0.0f)
+        {
+            CallbackHandler handler;
+            update(handler, waitTime);
+        }
+
+        // dispatches the events of this update to the handler instead of the socket callbacks, including the
+        // connect errors detected by timers, events raised outside of update (e.g. by Socket::connect and Socket::close)
+        // still use the callbacks
+        template <class Handler>
+        void update(Handler& handler, float waitTime = 0.0f)
+        {
+            // sockets destroyed since the last update are still in socketDeleteSet, commands to them are dropped
+            processCommands();
+
+            for (Socket* socket : socketDeleteSet)
+            {
+                auto i = std::find(sockets.begin(), sockets.end(), socket);
+
+                if (i != sockets.end())
+                    sockets.erase(i);
+
+                forwardedSockets.erase(socket);
+            }
+
+            socketDeleteSet.clear();
+
+            for (Socket* socket : socketAddSet)
+            {
+                auto i = std::find(sockets.begin(), sockets.end(), socket);
+
+                if (i == sockets.end())
+                {
+                    sockets.push_back(socket);
+                    socketsSorted = false;
+                }
+            }
+
+            socketAddSet.clear();
+
+            if (!socketsSorted)
+            {
+                std::stable_sort(sockets.begin(), sockets.end(), [](const Socket* a, const Socket* b) {
+                    return a->priority < b->priority;
+                });
+                socketsSorted = true;
+            }
+
+            // reused between updates, pollSockets[i] is the socket polled with pollFds[i + 1],
+            // pollClassEnds holds the end of each priority class in pollSockets
+            pollFds.clear();
+            pollSockets.clear();
+            pollClassEnds.clear();
+            pollFds.reserve(sockets.size() + 1);
+            pollSockets.reserve(sockets.size());
+
+            pollfd wakePollFd;
+            wakePollFd.fd = wakeFd;
+            wakePollFd.events = POLLIN;
+            wakePollFd.revents = 0;
+            pollFds.push_back(wakePollFd);
+
+            size_t openSockets = 0;
 
             for (auto socket : sockets)
             {
-                if (socket->socketFd != NULL_SOCKET)
+                // a socket connecting with connectParallel has no descriptor of its own until an attempt succeeds
+                const bool racing = socket->socketFd == NULL_SOCKET && socket->connecting &&
+                    socket->cold && !socket->cold->connectAttempts.empty();
+
+                if (socket->socketFd == NULL_SOCKET && !racing)
+                    continue;
+
+                ++openSockets;
+
+                if (socket->connecting)
+                {
+                    float timeLeft = std::max(0.0f, socket->getConnectTimeout() -
+                                              (socket->cold ? socket->cold->timeSinceConnect : 0.0f));
+                    if (waitTime < 0.0f || timeLeft < waitTime)
+                        waitTime = timeLeft;
+                }
+
+                if (!pollSockets.empty() && pollSockets.back()->priority != socket->priority)
+                    pollClassEnds.push_back(pollSockets.size());
+
+                if (racing)
+                {
+                    for (const Socket::ConnectAttempt& attempt : socket->cold->connectAttempts)
+                    {
+                        pollfd pollFd;
+                        pollFd.fd = attempt.fd;
+                        pollFd.events = POLLOUT;
+                        pollFd.revents = 0;
+
+                        pollFds.push_back(pollFd);
+                        pollSockets.push_back(socket);
+                    }
+                }
+                else
                 {
                     pollfd pollFd;
                     pollFd.fd = socket->socketFd;
-                    pollFd.events = POLLIN | POLLOUT;
+                    pollFd.events = POLLIN;
+                    pollFd.revents = 0;
+
+                    // requesting POLLOUT without pending output would keep poll from blocking,
+                    // paced sockets wait for their pacing timer instead
+                    if (socket->connecting || (socket->hasOutData() && !socket->paced))
+                        pollFd.events |= POLLOUT;
 
                     pollFds.push_back(pollFd);
+                    pollSockets.push_back(socket);
                 }
             }
 
-            if (!pollFds.empty())
+            pollClassEnds.push_back(pollSockets.size());
+
+            // closed sockets with zero-copy sends in flight, polled after the sockets for their error queues only
+            for (const LingeringSocket& lingeringSocket : lingeringSockets)
+            {
+                pollfd pollFd;
+                pollFd.fd = lingeringSocket.fd;
+                pollFd.events = 0;
+                pollFd.revents = 0;
+                pollFds.push_back(pollFd);
+
+                float timeLeft = std::max(0.0f, std::chrono::duration<float>(lingeringSocket.deadline -
+                                                                           std::chrono::steady_clock::now()).count());
+                if (waitTime < 0.0f || timeLeft < waitTime)
+                    waitTime = timeLeft;
+            }
+
+            socketCount.store(static_cast<std::ptrdiff_t>(openSockets), std::memory_order_relaxed);
+
+            if (!timerQueue.empty())
             {
+                float timeLeft = std::max(0.0f, std::chrono::duration<float>(timerQueue.begin()->first -
+                                                                           std::chrono::steady_clock::now()).count());
+                if (waitTime < 0.0f || timeLeft < waitTime)
+                    waitTime = timeLeft;
+            }
+
+            int timeout = (waitTime < 0.0f) ? -1 : static_cast<int>(std::ceil(waitTime * 1000.0f));
+
 #ifdef _WIN32
-                if (WSAPoll(pollFds.data(), static_cast<ULONG>(pollFds.size()), 0) < 0)
-                    throw std::system_error(WSAGetLastError(), std::system_category(), "Poll failed");
+            if (transport.poll(pollFds.data(), pollFds.size(), timeout) < 0)
+                throw std::system_error(WSAGetLastError(), std::system_category(), "Poll failed");
 #else
-                if (poll(pollFds.data(), static_cast<nfds_t>(pollFds.size()), 0) < 0)
-                    throw std::system_error(errno, std::system_category(), "Poll failed");
+            if (transport.poll(pollFds.data(), pollFds.size(), timeout) < 0 && errno != EINTR)
+                throw std::system_error(errno, std::system_category(), "Poll failed");
 #endif
 
+            auto currentTime = std::chrono::steady_clock::now();
+            float delta = std::chrono::duration<float>(currentTime - previousTime).count();
+            previousTime = currentTime;
+
+            // before any callback, which can close more sockets
+            updateLingeringSockets(currentTime);
+
+            if (pollFds[0].revents & POLLIN)
+            {
+                transport.drainWaker(wakeFd);
+                processCommands();
+            }
+
+            runTimers(currentTime);
+            reportConnectErrors(handler);
+
+            // higher priority classes first, the first socket served in each class rotates between updates
+            size_t classBegin = 0;
+
+            for (size_t classEnd : pollClassEnds)
+            {
+                const size_t count = classEnd - classBegin;
+
+                for (size_t i = 0; i < count; ++i)
+                    dispatch(handler, classBegin + (rotation + i) % count, delta);
+
+                classBegin = classEnd;
+            }
+
+            ++rotation;
+        }
+
+        Transport& getTransport() const { return transport; }
+
+        // number of open sockets polled by the last update, adjusted right away by Socket::migrate,
+        // can be read from any thread, e.g. to balance the connections between networks
+        size_t getSocketCount() const
+        {
+            const std::ptrdiff_t count = socketCount.load(std::memory_order_relaxed);
+            return (count > 0) ? static_cast<size_t>(count) : 0;
+        }
 
-                for (pollfd& pollFd : pollFds)
+        // receives the sockets migrated to this network, called from update on the thread of this network,
+        // has to be set before the first socket is migrated, without a callback the migrated sockets are closed
+        void setAdoptCallback(const std::function<void(std::unique_ptr<Socket>)>& newAdoptCallback)
+        {
+            adoptCallback = newAdoptCallback;
+        }
+
+        // wakes up a blocking update, can be called from any thread
+        void wake()
+        {
+            if (!wakePending.exchange(true))
+                transport.wake(wakeFd);
+        }
+
+        // calls the callback from update once delay seconds have passed,
+        // timers can only be added and cancelled on the thread that runs update
+        TimerId addTimer(float delay, std::function<void()> callback)
+        {
+            const TimerId id = nextTimerId++;
+            const auto deadline = std::chrono::steady_clock::now() +
+                std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float>(delay));
+
+            Timer& timer = timers[id];
+            timer.deadline = deadline;
+            timer.callback = std::move(callback);
+            timerQueue.insert(std::make_pair(deadline, id));
+
+            return id;
+        }
+
+        // does nothing if the timer has already fired or been cancelled
+        void cancelTimer(TimerId id)
+        {
+            auto i = timers.find(id);
+
+            if (i != timers.end())
+            {
+                timerQueue.erase(std::make_pair(i->second.deadline, id));
+                timers.erase(i);
+            }
+        }
+
+    private:
+        template <class Handler>
+        void dispatch(Handler& handler, size_t index, float delta)
+        {
+            const pollfd& pollFd = pollFds[index + 1];
+            Socket* socket = pollSockets[index];
+
+            // skip sockets destroyed by the callbacks of this update
+            if (socketDeleteSet.find(socket) != socketDeleteSet.end())
+                return;
+
+            if (socket->socketFd == NULL_SOCKET && socket->connecting && socket->cold)
+            {
+                if (pollFd.revents)
+                    socket->checkConnectAttempt(handler, pollFd.fd);
+
+                if (socketDeleteSet.find(socket) != socketDeleteSet.end())
+                    return;
+
+                // the connect timeout is checked once per update, with the first attempt of the socket
+                if (socket->connecting && socket->socketFd == NULL_SOCKET &&
+                    (index == 0 || pollSockets[index - 1] != socket))
+                    socket->update(delta, handler);
+
+                return;
+            }
+
+            // skip sockets closed by the callbacks of this update
+            if (socket->socketFd != pollFd.fd)
+                return;
+
+#ifdef __linux__
+            if ((pollFd.revents & POLLERR) && socket->cold &&
+                (!socket->cold->zeroCopyBuffers.empty() || socket->cold->timestamping))
+            {
+                while (socket->readErrorQueue(handler))
                 {
-                    for (Socket* deleteSocket : socketDeleteSet)
+                    if (socketDeleteSet.find(socket) != socketDeleteSet.end())
+                        return;
+                }
+            }
+#endif
+
+            if (pollFd.revents & POLLIN)
+            {
+                const size_t byteBudget = socket->getReadBudget();
+                const size_t eventBudget = socket->getReadEventBudget();
+                size_t bytes = 0;
+                size_t events = 0;
+
+                for (;;)
+                {
+                    const size_t size = socket->read(handler);
+
+                    // the socket can be destroyed by its callbacks
+                    if (socketDeleteSet.find(socket) != socketDeleteSet.end())
+                        return;
+
+                    bytes += size;
+                    ++events;
+
+                    // a blocking socket would block on the next read, a short read means that the socket has been drained
+                    if (!size || socket->blocking || socket->socketFd != pollFd.fd ||
+                        bytes >= byteBudget || events >= eventBudget ||
+                        (!socket->accepting && size < receiveBuffer.size()))
+                        break;
+                }
+            }
+
+            // a socket polled while paced is written as soon as its pacing timer has fired in this update,
+            // instead of waiting another poll round for POLLOUT
+            const bool paceResumed = !(pollFd.events & POLLOUT) && !socket->paced &&
+                socket->ready && socket->hasOutData();
+
+            if ((pollFd.revents & POLLOUT) || paceResumed)
+                socket->write(handler);
+
+            if (socketDeleteSet.find(socket) != socketDeleteSet.end())
+                return;
+
+            socket->update(delta, handler);
+        }
+
+        struct LingeringSocket final
+        {
+            socket_t fd = NULL_SOCKET;
+            std::deque<Socket::ZeroCopyBuffer> buffers;
+            uint32_t completed = 0;
+            uint32_t sequence = 0;
+            std::chrono::steady_clock::time_point deadline;
+        };
+
+        void updateLingeringSockets(std::chrono::steady_clock::time_point currentTime)
+        {
+            const size_t first = pollSockets.size() + 1;
+
+            for (size_t i = pollFds.size() - first; i-- > 0;)
+            {
+                LingeringSocket& lingeringSocket = lingeringSockets[i];
+                const short revents = pollFds[first + i].revents;
+
+                if (revents)
+                    readZeroCopyCompletions(lingeringSocket);
+
+                // a connection that has been shut down in both directions has released its send queue
+                if (lingeringSocket.completed == lingeringSocket.sequence ||
+                    (revents & (POLLHUP | POLLNVAL)) ||
+                    currentTime >= lingeringSocket.deadline)
+                {
+                    transport.close(lingeringSocket.fd);
+                    lingeringSockets.erase(lingeringSockets.begin() + static_cast<std::ptrdiff_t>(i));
+                }
+            }
+        }
+
+        static void readZeroCopyCompletions(LingeringSocket& lingeringSocket)
+        {
+#if defined(__linux__) && defined(SO_EE_ORIGIN_ZEROCOPY)
+            for (;;)
+            {
+                alignas(cmsghdr) uint8_t control[256];
+                msghdr message;
+                memset(&message, 0, sizeof(message));
+                message.msg_control = control;
+                message.msg_controllen = sizeof(control);
+
+                if (recvmsg(lingeringSocket.fd, &message, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+                    return;
+
+                for (cmsghdr* header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header))
+                {
+                    if ((header->cmsg_level == SOL_IP && header->cmsg_type == IP_RECVERR) ||
+                        (header->cmsg_level == SOL_IPV6 && header->cmsg_type == IPV6_RECVERR))
                     {
-                        auto i = std::find(sockets.begin(), sockets.end(), deleteSocket);
+                        sock_extended_err error;
+                        memcpy(&error, CMSG_DATA(header), sizeof(error));
 
-                        if (i != sockets.end())
-                            sockets.erase(i);
+                        if (error.ee_errno == 0 && error.ee_origin == SO_EE_ORIGIN_ZEROCOPY)
+                            lingeringSocket.completed = error.ee_data + 1;
                     }
+                }
+            }
+#else
+            (void)lingeringSocket;
+#endif
+        }
+
+        // the timers have no access to the handler, so they queue the failed connects for it
+        template <class Handler>
+        void reportConnectErrors(Handler& handler)
+        {
+            if (failedConnects.empty())
+                return;
+
+            std::vector<std::pair<Socket*, uint32_t>> failed;
+            failed.swap(failedConnects);
+
+            for (const auto& entry : failed)
+            {
+                // the socket can be destroyed by the timers or the previous handler calls
+                if (socketDeleteSet.find(entry.first) == socketDeleteSet.end() &&
+                    entry.first->socketId == entry.second)
+                    handler.onConnectError(*entry.first);
+            }
+        }
+
+        struct Timer final
+        {
+            std::chrono::steady_clock::time_point deadline;
+            std::function<void()> callback;
+        };
+
+        void runTimers(std::chrono::steady_clock::time_point currentTime)
+        {
+            // timers added by the callbacks fire in a later update
+            while (!timerQueue.empty() && timerQueue.begin()->first <= currentTime)
+            {
+                auto i = timers.find(timerQueue.begin()->second);
+                timerQueue.erase(timerQueue.begin());
+
+                std::function<void()> callback = std::move(i->second.callback);
+                timers.erase(i);
+
+                callback();
+            }
+        }
+
+        struct Command final
+        {
+            enum class Type
+            {
+                SEND,
+                CLOSE,
+                CONNECT,
+                ADOPT
+            };
+
+            Type type = Type::SEND;
+            Socket* socket = nullptr;
+            uint32_t socketId = 0;
+            std::vector<uint8_t> data;
+            uint32_t remoteAddress = 0;
+            uint16_t remotePort = 0;
+            std::unique_ptr<Socket> migratedSocket;
+
+            std::atomic<Command*> next{nullptr};
+        };
+
+        // where Socket::migrate has moved the connection of a socket of this network
+        struct Forward
+        {
+            uint32_t socketId;
+            Network* network;
+            Socket* socket;
+            uint32_t targetSocketId;
+        };
+
+        void addSocket(Socket& socket)
+        {
+            socket.socketId = nextSocketId.fetch_add(1, std::memory_order_relaxed);
+            registerSocket(socket);
+        }
+
+        void registerSocket(Socket& socket)
+        {
+            socketAddSet.insert(&socket);
+            forwardedSockets.erase(&socket);
+
+            auto setIterator = socketDeleteSet.find(&socket);
+
+            if (setIterator != socketDeleteSet.end())
+                socketDeleteSet.erase(setIterator);
+        }
+
+        void removeSocket(Socket& socket)
+        {
+            socketDeleteSet.insert(&socket);
+
+            auto setIterator = socketAddSet.find(&socket);
+
+            if (setIterator != socketAddSet.end())
+                socketAddSet.erase(setIterator);
+        }
+
+        // multiple producer, single consumer intrusive queue, producers never block
+        void pushCommand(Command* command)
+        {
+            command->next.store(nullptr, std::memory_order_relaxed);
+            Command* previous = commandHead.exchange(command, std::memory_order_acq_rel);
+            previous->next.store(command, std::memory_order_release);
+
+            wake();
+        }
 
-                    socketDeleteSet.clear();
+        Command* popCommand()
+        {
+            Command* tail = commandTail;
+            Command* next = tail->next.load(std::memory_order_acquire);
+
+            if (tail == &commandStub)
+            {
+                if (!next) return nullptr;
 
-                    auto i = std::find_if(sockets.begin(), sockets.end(), [&pollFd](Socket* socket) {
-                        return socket->socketFd == pollFd.fd;
-                    });
+                commandTail = next;
+                tail = next;
+                next = next->next.load(std::memory_order_acquire);
+            }
+
+            if (next)
+            {
+                commandTail = next;
+                return tail;
+            }
+
+            // a producer is in the middle of a push, the command will be picked up after its wake
+            if (tail != commandHead.load(std::memory_order_acquire))
+                return nullptr;
+
+            commandStub.next.store(nullptr, std::memory_order_relaxed);
+            Command* previous = commandHead.exchange(&commandStub, std::memory_order_acq_rel);
+            previous->next.store(&commandStub, std::memory_order_release);
+
+            next = tail->next.load(std::memory_order_acquire);
+
+            if (next)
+            {
+                commandTail = next;
+                return tail;
+            }
 
-                    if (i != sockets.end())
+            return nullptr;
+        }
+
+        void processCommands()
+        {
+            // cleared before draining, so that a command pushed during the drain wakes the next update
+            wakePending.store(false);
+
+            for (;;)
+            {
+                std::unique_ptr<Command> command;
+
+                // the commands held back by Socket::migrate were posted before the ones still in the queue
+                if (!heldCommands.empty())
+                {
+                    command = std::move(heldCommands.front());
+                    heldCommands.pop_front();
+                }
+                else if (Command* next = popCommand())
+                    command.reset(next);
+                else
+                    break;
+
+                processCommand(std::move(command));
+            }
+        }
+
+        void processCommand(std::unique_ptr<Command> command)
+        {
+            if (command->type == Command::Type::ADOPT)
+            {
+                adoptSocket(std::move(command->migratedSocket));
+                return;
+            }
+
+            // a destroyed socket stays in socketDeleteSet until a new socket is registered at its address
+            const bool deleted = socketDeleteSet.find(command->socket) != socketDeleteSet.end();
+
+            if (command->type == Command::Type::SEND || command->type == Command::Type::CLOSE)
+            {
+                auto forward = forwardedSockets.find(command->socket);
+
+                if (forward != forwardedSockets.end() && forward->second.socketId == command->socketId)
+                {
+                    // a socket that has been opened again takes its commands itself
+                    if (deleted || command->socket->socketFd == NULL_SOCKET)
                     {
-                        Socket* socket = *i;
+                        command->socket = forward->second.socket;
+                        command->socketId = forward->second.targetSocketId;
+                        forward->second.network->pushCommand(command.release());
+                        return;
+                    }
+
+                    forwardedSockets.erase(forward);
+                }
+            }
 
-                        if (pollFd.revents & POLLIN)
-                            socket->read();
+            if (deleted || command->socket->socketId != command->socketId)
+                return;
 
-                        if (pollFd.revents & POLLOUT)
-                            socket->write();
+            Socket& socket = *command->socket;
 
-                        socket->update(delta);
+            switch (command->type)
+            {
+                case Command::Type::SEND:
+                    if (socket.socketFd != NULL_SOCKET)
+                        socket.send(std::move(command->data));
+                    break;
+                case Command::Type::CLOSE:
+                    socket.close();
+                    break;
+                case Command::Type::CONNECT:
+                    try
+                    {
+                        socket.connect(command->remoteAddress, command->remotePort);
                     }
-                }
+                    catch (const std::system_error& e)
+                    {
+                        // nobody could catch it, the connect error callback has been called already and can have destroyed the socket
+                        if (socketDeleteSet.find(command->socket) == socketDeleteSet.end())
+                        {
+                            CallbackHandler handler;
+                            handler.onError(socket, e.code());
+                        }
+                    }
+                    break;
+                case Command::Type::ADOPT:
+                    break;
             }
         }
 
-    private:
-        void addSocket(Socket& socket)
+        // appends the data posted to the socket with postSend to its output, the other commands are held back in order
+        // for processCommands, so that Socket::migrate does not run them from inside a callback
+        void takePostedSends(Socket& socket)
         {
-            socketAddSet.insert(&socket);
+            std::deque<std::unique_ptr<Command>> commands;
+            commands.swap(heldCommands);
 
-            auto setIterator = socketDeleteSet.find(&socket);
+            while (Command* command = popCommand())
+                commands.emplace_back(command);
 
-            if (setIterator != socketDeleteSet.end())
-                socketDeleteSet.erase(setIterator);
+            for (std::unique_ptr<Command>& command : commands)
+            {
+                if (command->type == Command::Type::SEND && command->socket == &socket &&
+                    command->socketId == socket.socketId)
+                    socket.outData.insert(socket.outData.end(), command->data.begin(), command->data.end());
+                else
+                    heldCommands.push_back(std::move(command));
+            }
         }
 
-        void removeSocket(Socket& socket)
+        void adoptSocket(std::unique_ptr<Socket> socket)
         {
-            socketDeleteSet.insert(&socket);
+            // the id was assigned by Socket::migrate, so that commands could be forwarded before the adoption
+            registerSocket(*socket);
 
-            auto setIterator = socketAddSet.find(&socket);
+            // the sampler timer of the socket was cancelled on the network it came from
+            if (socket->cold && socket->cold->tcpInfoInterval > 0.0f && socket->cold->tcpInfoCallback)
+                socket->startTcpInfoSampler();
 
-            if (setIterator != socketAddSet.end())
-                socketAddSet.erase(setIterator);
+            // the socket is closed when it is destroyed without an adopt callback
+            if (adoptCallback)
+                adoptCallback(std::move(socket));
         }
 
 #ifdef _WIN32
         WinSock winSock;
 #endif
 
+        Transport& transport;
+
         std::vector<Socket*> sockets;
         std::set<Socket*> socketAddSet;
         std::set<Socket*> socketDeleteSet;
 
+        std::vector<pollfd> pollFds;
+        std::vector<Socket*> pollSockets;
+        std::vector<size_t> pollClassEnds;
+        bool socketsSorted = true;
+        size_t rotation = 0;
+
         std::chrono::steady_clock::time_point previousTime;
+
+        TimerId nextTimerId = 1;
+        std::map<TimerId, Timer> timers;
+        std::set<std::pair<std::chrono::steady_clock::time_point, TimerId>> timerQueue;
+        std::vector<std::pair<Socket*, uint32_t>> failedConnects;
+        std::vector<LingeringSocket> lingeringSockets;
+
+        // receive scratch space shared by all sockets instead of a buffer per socket
+        std::vector<uint8_t> receiveBuffer;
+        std::vector<uint8_t> inData;
+
+        socket_t wakeFd = NULL_SOCKET;
+        std::atomic<bool> wakePending{false};
+
+        std::function<void(std::unique_ptr<Socket>)> adoptCallback;
+        std::atomic<std::ptrdiff_t> socketCount{0};
+
+        // assigned from other threads too, by Socket::migrate
+        std::atomic<uint32_t> nextSocketId{1};
+        std::map<Socket*, Forward> forwardedSockets;
+        std::deque<std::unique_ptr<Command>> heldCommands;
+
+        Command commandStub;
+        std::atomic<Command*> commandHead{nullptr};
+        Command* commandTail = &commandStub;
     };
 
     Socket::Socket(Network& aNetwork):
@@ -851,60 +2543,526 @@ namespace cppsocket
 
         try
         {
-            writeData();
+            CallbackHandler handler;
+            writeData(handler);
         }
         catch (...)
         {
         }
 
+        stopPacing();
+        stopTcpInfoSampler();
+        stopConnectAttempts();
         closeSocketFd();
     }
 
     Socket::Socket(Socket&& other):
-        network(other.network),
+        Socket(other.network, std::move(other))
+    {
+        network.addSocket(*this);
+
+        // the timers refer to the other socket, this one polls for writing and paces again
+        stopPacing();
+        restartTcpInfoSampler();
+        restartConnectAttemptTimer();
+    }
+
+    Socket::Socket(Network& aNetwork, Socket&& other):
         socketFd(other.socketFd),
         ready(other.ready),
+        connecting(other.connecting),
+        accepting(other.accepting),
+        zeroCopyPending(other.zeroCopyPending),
+        paced(other.paced),
         blocking(other.blocking),
+        priority(other.priority),
+        outData(std::move(other.outData)),
+        network(aNetwork),
         localAddress(other.localAddress),
-        localPort(other.localPort),
         remoteAddress(other.remoteAddress),
+        localPort(other.localPort),
         remotePort(other.remotePort),
-        connectTimeout(other.connectTimeout),
-        timeSinceConnect(other.timeSinceConnect),
-        accepting(other.accepting),
-        connecting(other.connecting),
-        readCallback(std::move(other.readCallback)),
-        closeCallback(std::move(other.closeCallback)),
-        acceptCallback(std::move(other.acceptCallback)),
-        connectCallback(std::move(other.connectCallback)),
-        connectErrorCallback(std::move(other.connectErrorCallback)),
-        outData(std::move(other.outData))
+        cold(std::move(other.cold))
     {
-        network.addSocket(*this);
-
-        remoteAddressString = ipToString(remoteAddress) + ":" + std::to_string(remotePort);
-
         other.socketFd = NULL_SOCKET;
         other.ready = false;
+        other.connecting = false;
+        other.accepting = false;
+        other.zeroCopyPending = false;
+        other.paced = false;
         other.blocking = true;
+        other.priority = Priority::NORMAL;
         other.localAddress = 0;
-        other.localPort = 0;
         other.remoteAddress = 0;
+        other.localPort = 0;
         other.remotePort = 0;
-        other.connecting = false;
-        other.connectTimeout = 10.0f;
-        other.timeSinceConnect = 0.0f;
     }
 
     Socket::Socket(Network& aNetwork, socket_t aSocketFd, bool aReady,
            uint32_t aLocalAddress, uint16_t aLocalPort,
            uint32_t aRemoteAddress, uint16_t aRemotePort):
-        network(aNetwork), socketFd(aSocketFd), ready(aReady),
-        localAddress(aLocalAddress), localPort(aLocalPort),
-        remoteAddress(aRemoteAddress), remotePort(aRemotePort)
+        socketFd(aSocketFd), ready(aReady), network(aNetwork),
+        localAddress(aLocalAddress), remoteAddress(aRemoteAddress),
+        localPort(aLocalPort), remotePort(aRemotePort)
+    {
+        network.addSocket(*this);
+    }
+
+    Socket::Socket(Network& aNetwork, socket_t aSocketFd):
+        socketFd(aSocketFd), network(aNetwork)
     {
-        remoteAddressString = ipToString(remoteAddress) + ":" + std::to_string(remotePort);
+        int value = 0;
+#ifdef _WIN32
+        int valueLength = static_cast<int>(sizeof(value));
+#else
+        socklen_t valueLength = sizeof(value);
+#endif
+
+        if (getTransport().getsockopt(socketFd, SOL_SOCKET, SO_ACCEPTCONN, &value, &valueLength) != 0)
+            throw std::system_error(getLastError(), std::system_category(), "getsockopt(SO_ACCEPTCONN) failed");
+
+        accepting = (value != 0);
+
+        sockaddr_in address;
+#ifdef _WIN32
+        int addressLength = static_cast<int>(sizeof(address));
+#else
+        socklen_t addressLength = sizeof(address);
+#endif
+
+        if (getTransport().getsockname(socketFd, reinterpret_cast<sockaddr*>(&address), &addressLength) != 0)
+            throw std::system_error(getLastError(), std::system_category(), "Failed to get address of the adopted socket");
+
+        localAddress = address.sin_addr.s_addr;
+        localPort = ntohs(address.sin_port);
+
+        if (!accepting)
+        {
+            addressLength = sizeof(address);
+
+            if (getTransport().getpeername(socketFd, reinterpret_cast<sockaddr*>(&address), &addressLength) != 0)
+                throw std::system_error(getLastError(), std::system_category(), "Failed to get peer address of the adopted socket");
+
+            remoteAddress = address.sin_addr.s_addr;
+            remotePort = ntohs(address.sin_port);
+        }
+
+        blocking = getTransport().isBlocking(socketFd);
+
+        ready = true;
         network.addSocket(*this);
     }
+
+    inline Transport& Socket::getTransport() const
+    {
+        return network.transport;
+    }
+
+    inline void Socket::lingerSocketFd()
+    {
+#if defined(__linux__) && defined(SO_ZEROCOPY)
+        // the peer sees the end of the stream now instead of when the descriptor is closed
+        ::shutdown(socketFd, SHUT_WR);
+#endif
+
+        Network::LingeringSocket lingeringSocket;
+        lingeringSocket.fd = socketFd;
+        lingeringSocket.buffers.swap(cold->zeroCopyBuffers);
+        lingeringSocket.completed = cold->zeroCopyCompleted;
+        lingeringSocket.sequence = cold->zeroCopySequence;
+        lingeringSocket.deadline = std::chrono::steady_clock::now() +
+            std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float>(ZERO_COPY_LINGER_TIME));
+
+        network.lingeringSockets.push_back(std::move(lingeringSocket));
+    }
+
+    inline std::vector<uint8_t>& Socket::getReceiveBuffer()
+    {
+        return network.receiveBuffer;
+    }
+
+    inline std::vector<uint8_t>& Socket::getInData()
+    {
+        return network.inData;
+    }
+
+    inline void Socket::setPriority(Priority newPriority)
+    {
+        if (priority != newPriority)
+        {
+            priority = newPriority;
+            network.socketsSorted = false;
+        }
+    }
+
+    inline void Socket::startPacing(float delay)
+    {
+        paced = true;
+
+        getCold().pacingTimer = network.addTimer(delay, [this]() {
+            paced = false;
+        });
+    }
+
+    inline void Socket::stopPacing()
+    {
+        if (paced)
+        {
+            network.cancelTimer(cold->pacingTimer);
+            paced = false;
+        }
+    }
+
+    inline void Socket::connectParallel(const std::vector<std::pair<uint32_t, uint16_t>>& addresses, float attemptDelay)
+    {
+        ready = false;
+        connecting = false;
+
+        if (socketFd != NULL_SOCKET)
+            close();
+        else
+            stopConnectAttempts();
+
+        if (addresses.empty())
+            throw std::runtime_error("No address to connect to");
+
+        Cold& data = getCold();
+        data.pendingAddresses.assign(addresses.begin(), addresses.end());
+        data.attemptDelay = attemptDelay;
+        data.timeSinceConnect = 0.0f;
+
+        remoteAddress = addresses.front().first;
+        remotePort = addresses.front().second;
+        connecting = true;
+
+        int error = 0;
+        if (!startConnectAttempt(error))
+        {
+            connecting = false;
+
+            std::string message = "Failed to connect to " + getRemoteAddressString();
+
+            CallbackHandler handler;
+            handler.onConnectError(*this);
+
+            throw std::system_error(error, std::system_category(), message);
+        }
+    }
+
+    // starts a connection to the next pending address, returns false if no attempt is running
+    inline bool Socket::startConnectAttempt(int& error)
+    {
+        Cold& data = getCold();
+
+        if (data.attemptTimer)
+        {
+            network.cancelTimer(data.attemptTimer);
+            data.attemptTimer = 0;
+        }
+
+        while (!data.pendingAddresses.empty())
+        {
+            const std::pair<uint32_t, uint16_t> address = data.pendingAddresses.front();
+            data.pendingAddresses.pop_front();
+
+            socket_t fd = getTransport().socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+            if (fd == NULL_SOCKET)
+            {
+                error = getLastError();
+                continue;
+            }
+
+            sockaddr_in addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = address.first;
+            addr.sin_port = htons(address.second);
+
+            try
+            {
+                getTransport().setBlocking(fd, false);
+            }
+            catch (const std::system_error& e)
+            {
+                error = e.code().value();
+                closeSocketFd(fd);
+                continue;
+            }
+
+            if (getTransport().connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) < 0)
+            {
+                error = getLastError();
+
+#ifdef _WIN32
+                if (error != WSAEWOULDBLOCK &&
+                    error != WSAEINPROGRESS)
+#else
+                if (error != EAGAIN &&
+                    error != EWOULDBLOCK &&
+                    error != EINPROGRESS)
+#endif
+                {
+                    closeSocketFd(fd);
+                    continue;
+                }
+            }
+
+            // a connection that succeeded immediately is picked up by the next poll
+            ConnectAttempt attempt;
+            attempt.fd = fd;
+            attempt.address = address.first;
+            attempt.port = address.second;
+            data.connectAttempts.push_back(attempt);
+
+            if (!data.pendingAddresses.empty())
+                restartConnectAttemptTimer();
+
+            return true;
+        }
+
+        return !data.connectAttempts.empty();
+    }
+
+    inline void Socket::adoptConnectAttempt(size_t index)
+    {
+        Cold& data = getCold();
+        const ConnectAttempt attempt = data.connectAttempts[index];
+        data.connectAttempts.erase(data.connectAttempts.begin() + static_cast<std::ptrdiff_t>(index));
+
+        stopConnectAttempts();
+
+        socketFd = attempt.fd;
+        remoteAddress = attempt.address;
+        remotePort = attempt.port;
+        connecting = false;
+        ready = true;
+
+        // the attempts are non-blocking, the options of the socket are applied to the winner
+        if (blocking)
+            setFdBlocking(true);
+
+        setFdOptions();
+
+        sockaddr_in localAddr;
+#ifdef _WIN32
+        int localAddrSize = static_cast<int>(sizeof(localAddr));
+#else
+        socklen_t localAddrSize = sizeof(localAddr);
+#endif
+
+        if (getTransport().getsockname(socketFd, reinterpret_cast<sockaddr*>(&localAddr), &localAddrSize) == 0)
+        {
+            localAddress = localAddr.sin_addr.s_addr;
+            localPort = ntohs(localAddr.sin_port);
+        }
+    }
+
+    inline void Socket::stopConnectAttempts()
+    {
+        if (!cold)
+            return;
+
+        if (cold->attemptTimer)
+        {
+            network.cancelTimer(cold->attemptTimer);
+            cold->attemptTimer = 0;
+        }
+
+        for (const ConnectAttempt& attempt : cold->connectAttempts)
+            closeSocketFd(attempt.fd);
+
+        cold->connectAttempts.clear();
+        cold->pendingAddresses.clear();
+    }
+
+    inline void Socket::restartConnectAttemptTimer()
+    {
+        if (!cold)
+            return;
+
+        if (cold->attemptTimer)
+        {
+            network.cancelTimer(cold->attemptTimer);
+            cold->attemptTimer = 0;
+        }
+
+        if (cold->pendingAddresses.empty())
+            return;
+
+        cold->attemptTimer = network.addTimer(cold->attemptDelay, [this]() {
+            cold->attemptTimer = 0;
+
+            int error = 0;
+            if (!startConnectAttempt(error))
+            {
+                connecting = false;
+
+                // reported through the handler of the update that runs the timer
+                network.failedConnects.push_back(std::make_pair(this, socketId));
+            }
+        });
+    }
+
+    inline void Socket::startTcpInfoSampler()
+    {
+        Cold& data = getCold();
+
+        data.tcpInfoTimer = network.addTimer(data.tcpInfoInterval, [this]() {
+            cold->tcpInfoTimer = 0;
+
+            // armed before the callback, which can destroy the socket
+            startTcpInfoSampler();
+
+            TcpInfo info;
+            if (getTcpInfo(info))
+                cold->tcpInfoCallback(*this, info);
+        });
+    }
+
+    inline void Socket::stopTcpInfoSampler()
+    {
+        if (cold && cold->tcpInfoTimer)
+        {
+            network.cancelTimer(cold->tcpInfoTimer);
+            cold->tcpInfoTimer = 0;
+        }
+    }
+
+    inline void Socket::restartTcpInfoSampler()
+    {
+        if (cold && cold->tcpInfoTimer)
+        {
+            stopTcpInfoSampler();
+            startTcpInfoSampler();
+        }
+    }
+
+    inline void CallbackHandler::onRead(Socket& socket, const std::vector<uint8_t>& data)
+    {
+        if (socket.cold && socket.cold->readCallback)
+            socket.cold->readCallback(socket, data);
+    }
+
+    inline void CallbackHandler::onClose(Socket& socket)
+    {
+        if (socket.cold && socket.cold->closeCallback)
+            socket.cold->closeCallback(socket);
+    }
+
+    inline void CallbackHandler::onAccept(Socket& socket, Socket& client)
+    {
+        if (socket.cold && socket.cold->acceptCallback)
+            socket.cold->acceptCallback(socket, client);
+    }
+
+    inline void CallbackHandler::onConnect(Socket& socket)
+    {
+        if (socket.cold && socket.cold->connectCallback)
+            socket.cold->connectCallback(socket);
+    }
+
+    inline void CallbackHandler::onConnectError(Socket& socket)
+    {
+        if (socket.cold && socket.cold->connectErrorCallback)
+            socket.cold->connectErrorCallback(socket);
+    }
+
+    inline void CallbackHandler::onDrain(Socket& socket)
+    {
+        if (socket.cold && socket.cold->drainCallback)
+            socket.cold->drainCallback(socket);
+    }
+
+    inline void CallbackHandler::onSendTimestamp(Socket& socket, const SendTimestamp& timestamp)
+    {
+        if (socket.cold && socket.cold->sendTimestampCallback)
+            socket.cold->sendTimestampCallback(socket, timestamp);
+    }
+
+    inline bool CallbackHandler::onError(Socket& socket, const std::error_code& error)
+    {
+        if (!socket.cold || !socket.cold->errorCallback)
+            return false;
+
+        socket.cold->errorCallback(socket, error);
+        return true;
+    }
+
+    inline void Socket::migrate(Network& target)
+    {
+        if (&target == &network)
+            return;
+
+        if (socketFd == NULL_SOCKET || connecting)
+            throw std::runtime_error("Only open sockets that are not connecting can be migrated");
+
+        // sends posted from other threads before the migration go with the socket instead of being dropped
+        network.takePostedSends(*this);
+
+        Network::Command* command = new Network::Command();
+        command->type = Network::Command::Type::ADOPT;
+
+        // the timers belong to this network, the sampler is restarted by the target
+        stopPacing();
+        stopTcpInfoSampler();
+
+        if (cold)
+            cold->sendGroup.reset();
+
+        Socket* migratedSocket = new Socket(target, std::move(*this));
+        migratedSocket->socketId = target.nextSocketId.fetch_add(1, std::memory_order_relaxed);
+        command->migratedSocket.reset(migratedSocket);
+        outData.clear();
+
+        Network::Forward& forward = network.forwardedSockets[this];
+        forward.socketId = socketId;
+        forward.network = &target;
+        forward.socket = migratedSocket;
+        forward.targetSocketId = migratedSocket->socketId;
+
+        network.socketCount.fetch_sub(1, std::memory_order_relaxed);
+        target.socketCount.fetch_add(1, std::memory_order_relaxed);
+
+        target.pushCommand(command);
+    }
+
+    inline void Socket::postSend(std::vector<uint8_t> buffer)
+    {
+        Network::Command* command = new Network::Command();
+        command->type = Network::Command::Type::SEND;
+        command->socket = this;
+        command->socketId = socketId;
+        command->data = std::move(buffer);
+        network.pushCommand(command);
+    }
+
+    inline void Socket::postClose()
+    {
+        Network::Command* command = new Network::Command();
+        command->type = Network::Command::Type::CLOSE;
+        command->socket = this;
+        command->socketId = socketId;
+        network.pushCommand(command);
+    }
+
+    inline void Socket::postConnect(const std::string& address)
+    {
+        // a blocking lookup would stall the network thread
+        const std::pair<uint32_t, uint16_t> addr = getAddress(address);
+
+        postConnect(addr.first, addr.second);
+    }
+
+    inline void Socket::postConnect(uint32_t address, uint16_t newPort)
+    {
+        Network::Command* command = new Network::Command();
+        command->type = Network::Command::Type::CONNECT;
+        command->socket = this;
+        command->socketId = socketId;
+        command->remoteAddress = address;
+        command->remotePort = newPort;
+        network.pushCommand(command);
+    }
 }
 #endif // CPPSOCKET_HPP
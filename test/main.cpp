@@ -7,16 +7,104 @@
 #include <thread>
 #include <sstream>
 #include "Socket.hpp"
+#include "MemoryTransport.hpp"
 
 static void printUsage(const std::string& executable)
 {
     std::cout << "Usage: " << executable << " [server|client] [port|address]" << std::endl;
+    std::cout << "       " << executable << " memory" << std::endl;
+}
+
+// scripts a partial write, a blocked write and a reset with MemoryTransport, returns false if the sockets misbehave
+static bool testMemoryTransport()
+{
+#ifdef _WIN32
+    const int wouldBlock = WSAEWOULDBLOCK;
+#else
+    const int wouldBlock = EWOULDBLOCK;
+#endif
+
+    cppsocket::MemoryTransport transport;
+    cppsocket::Network network(transport);
+
+    std::pair<cppsocket::socket_t, cppsocket::socket_t> fds = transport.createPair();
+    cppsocket::Socket sender(network, fds.first);
+    cppsocket::Socket receiver(network, fds.second);
+    sender.setBlocking(false);
+    receiver.setBlocking(false);
+
+    std::vector<uint8_t> received;
+    int drains = 0;
+    int closes = 0;
+    int errors = 0;
+
+    receiver.setReadCallback([&received](cppsocket::Socket&, const std::vector<uint8_t>& data) {
+        received.insert(received.end(), data.begin(), data.end());
+    });
+    sender.setDrainCallback([&drains](cppsocket::Socket&) { ++drains; });
+
+    auto countClose = [&closes](cppsocket::Socket&) { ++closes; };
+    auto countError = [&errors](cppsocket::Socket&, const std::error_code&) { ++errors; };
+    sender.setCloseCallback(countClose);
+    receiver.setCloseCallback(countClose);
+    sender.setErrorCallback(countError);
+    receiver.setErrorCallback(countError);
+
+    std::vector<uint8_t> data(100);
+    for (size_t i = 0; i < data.size(); ++i)
+        data[i] = static_cast<uint8_t>(i);
+
+    // the first send writes 10 bytes and the second one would block, the rest goes out in later updates
+    transport.limitSend(fds.first, 10);
+    transport.failSend(fds.first, wouldBlock);
+    sender.send(data);
+
+    network.update();
+
+    if (!sender.hasOutData() || received.size() > 10)
+    {
+        std::cerr << "Partial write: " << received.size() << " bytes received in the first update" << std::endl;
+        return false;
+    }
+
+    for (int i = 0; i < 4 && (sender.hasOutData() || received.size() < data.size()); ++i)
+        network.update();
+
+    if (received != data || drains != 1)
+    {
+        std::cerr << "Partial write: " << received.size() << " bytes received, " << drains << " drains" << std::endl;
+        return false;
+    }
+
+    transport.reset(fds.first);
+    network.update();
+
+    if (sender.isReady() || receiver.isReady() || closes != 2)
+    {
+        std::cerr << "Reset: " << closes << " sockets closed" << std::endl;
+        return false;
+    }
+
+    // the waker of the network is a memory descriptor, so a wake ends an update that would block forever
+    std::thread waker([&network]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        network.wake();
+    });
+    network.update(-1.0f);
+    waker.join();
+
+    std::cout << "MemoryTransport test passed" << std::endl;
+
+    return true;
 }
 
 int main(int argc, const char* argv[])
 {
     try
     {
+        if (argc == 2 && std::string(argv[1]) == "memory")
+            return testMemoryTransport() ? EXIT_SUCCESS : EXIT_FAILURE;
+
         if (argc < 3)
         {
             printUsage(argc ? argv[0] : "test");